@@ -0,0 +1,102 @@
+#pragma once
+
+#include <pthread.h>
+#include "page.h"
+#include "values.h"
+
+typedef enum { BACKUP_SUCCESS, BACKUP_IN_PROGRESS, BACKUP_OPEN_FAILED } backup_result_t;
+
+// Streams every page of the backup's read view to the backup file.
+void* backup_run(void* arg) {
+    backup_t* backup = arg;
+    pager_t* pager = backup->pager;
+
+    void* page = NULL;
+    if (posix_memalign(&page, PAGE_SIZE, PAGE_SIZE) != 0) {
+        backup->error = ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < backup->view->num_pages && backup->error == 0; i++) {
+        backup->error = pager_read_page(pager, backup->view, i, page);
+        if (backup->error == 0 && pwrite(backup->file_descriptor, page, PAGE_SIZE, (off_t)i * PAGE_SIZE) == -1) {
+            backup->error = errno;
+        }
+    }
+    if (backup->error == 0 && fsync(backup->file_descriptor) == -1) {
+        backup->error = errno;
+    }
+    close(backup->file_descriptor);
+    free(page);
+    // Writes after this point no longer have to preserve pages for the copy.
+    pager_close_read_view(pager, backup->view);
+
+    pthread_mutex_lock(&pager->lock);
+    backup->done = true;
+    pthread_mutex_unlock(&pager->lock);
+    return NULL;
+}
+
+// Waits for the table's backup, if any, and reports whether it failed.
+void backup_finish(table_t* table) {
+    backup_t* backup = table->backup;
+    if (backup == NULL) {
+        return;
+    }
+
+    pthread_join(backup->thread, NULL);
+    backup->pager->num_reader_threads -= 1;
+    if (backup->error != 0) {
+        printf("Backup failed: %d\n", backup->error);
+    }
+    free(backup);
+    table->backup = NULL;
+}
+
+// Joins the table's backup if its thread is done, like get_page joins warm-up.
+void backup_poll(table_t* table) {
+    backup_t* backup = table->backup;
+    if (backup == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&backup->pager->lock);
+    bool done = backup->done;
+    pthread_mutex_unlock(&backup->pager->lock);
+    if (done) {
+        backup_finish(table);
+    }
+}
+
+/*
+ * Opens a read view of the table and copies it to `path` on a background thread.
+ * Writes that happen meanwhile only pay for copying the pages they touch. The
+ * thread closes the view as soon as the copy is written.
+ */
+backup_result_t backup_start(table_t* table, const char* path) {
+    pager_t* pager = table->pager;
+
+    backup_poll(table);
+    if (table->backup != NULL) {
+        return BACKUP_IN_PROGRESS;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        return BACKUP_OPEN_FAILED;
+    }
+
+    backup_t* backup = malloc(sizeof(backup_t));
+    backup->pager = pager;
+    backup->file_descriptor = fd;
+    backup->done = false;
+    backup->error = 0;
+
+    backup->view = pager_open_read_view(pager);
+    pager->num_reader_threads += 1;
+    if (pthread_create(&backup->thread, NULL, backup_run, backup) != 0) {
+        printf("Unable to start backup thread\n");
+        exit(EXIT_FAILURE);
+    }
+    table->backup = backup;
+    return BACKUP_SUCCESS;
+}
@@ -6,37 +6,42 @@
 #include "page.h"
 #include "node.h"
 
-cursor_t * leaf_node_find(table_t * table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
+// The cell holding `key`, or the one it would be inserted at.
+uint32_t leaf_node_find_cell(void* node, const void* key) {
     uint32_t num_cells = *leaf_node_num_cells(node);
 
-    cursor_t * cur = malloc(sizeof(cursor_t));
-    cur->table = table;
-    cur->page_num = page_num;
-
     // Binary Search
     uint32_t min_index = 0;
     uint32_t one_past_max_index = num_cells;
 
     while (one_past_max_index != min_index) {
         uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cur->cell_num = index;
-            return cur;
+        int cmp = compare_keys(key, leaf_node_key(node, index));
+        if (cmp == 0) {
+            return index;
         }
-        if (key < key_at_index) {
+        if (cmp < 0) {
             one_past_max_index = index;
         } else {
             min_index = index + 1;
         }
     }
+    return min_index;
+}
+
+cursor_t * leaf_node_find(table_t * table, uint32_t page_num, const void* key) {
+    void* node = get_page(table->pager, page_num);
 
-    cur->cell_num = min_index;
+    cursor_t * cur = malloc(sizeof(cursor_t));
+    cur->table = table;
+    cur->page_num = page_num;
+    cur->cell_num = leaf_node_find_cell(node, key);
+    cur->view = NULL;
+    cur->page = NULL;
     return cur;
 }
 
-uint32_t internal_node_find_child(void* node, uint32_t key) {
+uint32_t internal_node_find_child(void* node, const void* key) {
     uint32_t num_keys = *internal_node_num_keys(node);
 
     uint32_t min_index = 0;
@@ -44,8 +49,8 @@ uint32_t internal_node_find_child(void* node, uint32_t key) {
 
     while (min_index != max_index) {
         uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key <= key_to_right) {
+        void* key_to_right = internal_node_key(node, index);
+        if (compare_key_to_separator(key, key_to_right, *internal_node_key_len(node, index)) <= 0) {
             max_index = index;
         } else {
             min_index = index + 1;
@@ -54,7 +59,7 @@ uint32_t internal_node_find_child(void* node, uint32_t key) {
     return min_index;
 }
 
-cursor_t * internal_node_find(table_t * table, uint32_t page_num, uint32_t key) {
+cursor_t * internal_node_find(table_t * table, uint32_t page_num, const void* key) {
     void* node = get_page(table->pager, page_num);
 
     uint32_t child_index = internal_node_find_child(node, key);
@@ -68,28 +73,58 @@ cursor_t * internal_node_find(table_t * table, uint32_t page_num, uint32_t key)
     }
 }
 
+void* get_node_max_key(pager_t* pager, void* node) {
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = get_page(pager, *internal_node_right_child(node));
+    }
+    return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+}
+
+void* get_node_min_key(pager_t* pager, void* node) {
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = get_page(pager, *internal_node_child(node, 0));
+    }
+    return leaf_node_key(node, 0);
+}
+
+// Stores the shortest separator between two adjacent children as the key of `key_num`.
+void internal_node_set_separator(table_t * table, void* node, uint32_t key_num, uint32_t left_page_num,
+                                 uint32_t right_page_num) {
+    uint8_t left_max[KEY_SIZE];
+    uint8_t right_min[KEY_SIZE];
+    memcpy(left_max, get_node_max_key(table->pager, get_page(table->pager, left_page_num)), KEY_SIZE);
+    memcpy(right_min, get_node_min_key(table->pager, get_page(table->pager, right_page_num)), KEY_SIZE);
+
+    internal_node_set_key(node, key_num, left_max, separator_length(left_max, right_min));
+}
+
 void internal_node_insert(table_t * table, uint32_t parent_page_num, uint32_t child_page_num) {
-    void* parent = get_page(table->pager, parent_page_num);
+    void* parent = get_page_for_write(table->pager, parent_page_num);
     void* child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(child);
+    uint8_t child_max_key[KEY_SIZE];
+    memcpy(child_max_key, get_node_max_key(table->pager, child), KEY_SIZE);
     uint32_t index = internal_node_find_child(parent, child_max_key);
 
-    uint32_t original_num_keys = *internal_node_num_keys(parent);
-    *internal_node_num_keys(parent) = original_num_keys + 1;
-
-    if (INTERNAL_NODE_MAX_CELLS <= original_num_keys) {
+    if (internal_node_free_space(parent) < INTERNAL_NODE_MIN_FREE_SPACE) {
+        internal_node_compact_keys(parent);
+    }
+    if (internal_node_free_space(parent) < INTERNAL_NODE_MIN_FREE_SPACE) {
         printf("Need to implement splitting internal node\n");
         exit(EXIT_FAILURE);
     }
 
+    uint32_t original_num_keys = *internal_node_num_keys(parent);
+    *internal_node_num_keys(parent) = original_num_keys + 1;
+
     uint32_t right_child_page_num = *internal_node_right_child(parent);
     void* right_child = get_page(table->pager, right_child_page_num);
 
-    if (get_node_max_key(right_child) < child_max_key) {
+    if (compare_keys(get_node_max_key(table->pager, right_child), child_max_key) < 0) {
         // Replace right child
         *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) = get_node_max_key(right_child);
+        *internal_node_key_len(parent, original_num_keys) = 0;
         *internal_node_right_child(parent) = child_page_num;
+        internal_node_set_separator(table, parent, original_num_keys, right_child_page_num, child_page_num);
     } else {
         // Make room for the new cell
         for (uint32_t i = original_num_keys; index < i; i--) {
@@ -97,23 +132,32 @@ void internal_node_insert(table_t * table, uint32_t parent_page_num, uint32_t ch
             void* src = internal_node_cell(parent, i - 1);
             memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
         }
+        // The slot still aliases its neighbour's key bytes; drop them before writing.
         *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
+        *internal_node_key_len(parent, index) = 0;
+        internal_node_set_separator(table, parent, index, child_page_num, *internal_node_child(parent, index + 1));
     }
 }
 
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
+// Recomputes the separator that bounds `left_page_num` after it gave cells to its new right sibling.
+void update_internal_node_key(table_t * table, uint32_t page_num, const void* old_key, uint32_t left_page_num,
+                              uint32_t right_page_num) {
+    void* node = get_page_for_write(table->pager, page_num);
     uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+    if (old_child_index == *internal_node_num_keys(node)) {
+        // The right child has no key of its own.
+        return;
+    }
+    internal_node_set_separator(table, node, old_child_index, left_page_num, right_page_num);
 }
 
 uint32_t get_unused_page_num(pager_t* pager) { return pager->num_pages; }
 
 void create_new_root(table_t * table, uint32_t right_child_page_num) {
-    void* root = get_page(table->pager, table->root_page_num);
-    void* right_child = get_page(table->pager, right_child_page_num);
+    void* root = get_page_for_write(table->pager, table->root_page_num);
+    void* right_child = get_page_for_write(table->pager, right_child_page_num);
     uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void* left_child = get_page(table->pager, left_child_page_num);
+    void* left_child = get_page_for_write(table->pager, left_child_page_num);
 
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
@@ -122,18 +166,19 @@ void create_new_root(table_t * table, uint32_t right_child_page_num) {
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
+    *internal_node_key_len(root, 0) = 0;
     *internal_node_right_child(root) = right_child_page_num;
+    internal_node_set_separator(table, root, 0, left_child_page_num, right_child_page_num);
     *node_parent(left_child) = table->root_page_num;
     *node_parent(right_child) = table->root_page_num;
 }
 
-void leaf_node_split_and_insert(cursor_t * cursor, uint32_t key, row_t* value) {
-    void* old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(old_node);
+void leaf_node_split_and_insert(cursor_t * cursor, const void* key, row_t* value) {
+    void* old_node = get_page_for_write(cursor->table->pager, cursor->page_num);
+    uint8_t old_max[KEY_SIZE];
+    memcpy(old_max, get_node_max_key(cursor->table->pager, old_node), KEY_SIZE);
     uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void* new_node = get_page(cursor->table->pager, new_page_num);
+    void* new_node = get_page_for_write(cursor->table->pager, new_page_num);
     initialize_leaf_node(new_node);
     *node_parent(new_node) = *node_parent(old_node);
     *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
@@ -151,7 +196,7 @@ void leaf_node_split_and_insert(cursor_t * cursor, uint32_t key, row_t* value) {
 
         if (i == cursor->cell_num) {
             serialize_row(value, leaf_node_value(dest_node, index));
-            *leaf_node_key(dest_node, index) = key;
+            memcpy(leaf_node_key(dest_node, index), key, KEY_SIZE);
         } else if (cursor->cell_num < i) {
             memcpy(dest, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
         } else {
@@ -166,17 +211,15 @@ void leaf_node_split_and_insert(cursor_t * cursor, uint32_t key, row_t* value) {
         return create_new_root(cursor->table, new_page_num);
     } else {
         uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max = get_node_max_key(old_node);
-        void *parent = get_page(cursor->table->pager, parent_page_num);
 
-        update_internal_node_key(parent, old_max, new_max);
+        update_internal_node_key(cursor->table, parent_page_num, old_max, cursor->page_num, new_page_num);
         internal_node_insert(cursor->table, parent_page_num, new_page_num);
         return;
     }
 }
 
-void leaf_node_insert(cursor_t * cursor, uint32_t key, row_t* value) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
+void leaf_node_insert(cursor_t * cursor, const void* key, row_t* value) {
+    void* node = get_page_for_write(cursor->table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(node);
     if (LEAF_NODE_MAX_CELLS <= num_cells) {
@@ -193,6 +236,6 @@ void leaf_node_insert(cursor_t * cursor, uint32_t key, row_t* value) {
     }
 
     *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
+    memcpy(leaf_node_key(node, cursor->cell_num), key, KEY_SIZE);
     serialize_row(value, leaf_node_value(node, cursor->cell_num));
 }
\ No newline at end of file
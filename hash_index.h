@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include "key.h"
+#include "node.h"
+#include "page.h"
+#include "values.h"
+
+/*
+ * Adaptive hash index
+ *
+ * A direct-mapped table from key hash to the (page, cell) a descent last found
+ * the key at. A key is only served from the table once it has been looked up
+ * HASH_INDEX_PROMOTE_THRESHOLD times without another key taking over its
+ * bucket, so one-off lookups never skip the descent.
+ *
+ * Entries do not need explicit invalidation: each one remembers the commit
+ * that produced the page's image, and the next transaction to write the page
+ * makes it stale. Pages the open transaction has written are neither recorded
+ * nor served, since they can still change without a new commit.
+ */
+const uint32_t HASH_INDEX_NUM_BUCKETS = 4096;  // Must be a power of two
+const uint32_t HASH_INDEX_PROMOTE_THRESHOLD = 3;
+
+hash_index_t* hash_index_new() {
+    hash_index_t* index = malloc(sizeof(hash_index_t));
+    index->buckets = calloc(HASH_INDEX_NUM_BUCKETS, sizeof(hash_index_entry_t));
+    index->num_hits = 0;
+    return index;
+}
+
+void hash_index_free(hash_index_t* index) {
+    free(index->buckets);
+    free(index);
+}
+
+hash_index_entry_t* hash_index_bucket(hash_index_t* index, uint64_t hash) {
+    return &index->buckets[hash & (HASH_INDEX_NUM_BUCKETS - 1)];
+}
+
+// Returns a cursor at `key` if the index knows where it lives, NULL otherwise.
+cursor_t* hash_index_find(hash_index_t* index, table_t* table, const void* key) {
+    uint64_t hash = hash_key(key);
+    hash_index_entry_t* entry = hash_index_bucket(index, hash);
+
+    if (entry->hash != hash || entry->hits < HASH_INDEX_PROMOTE_THRESHOLD) {
+        return NULL;
+    }
+    uint64_t page_commit_seq = table->pager->page_commit_seqs[entry->page_num];
+    if (entry->page_commit_seq != page_commit_seq || table->pager->commit_seq < page_commit_seq) {
+        return NULL;
+    }
+
+    // The page is unchanged since the entry was made, but the bucket may belong to a colliding key.
+    void* node = get_page(table->pager, entry->page_num);
+    if (*leaf_node_num_cells(node) <= entry->cell_num ||
+        compare_keys(leaf_node_key(node, entry->cell_num), key) != 0) {
+        return NULL;
+    }
+
+    cursor_t* cur = malloc(sizeof(cursor_t));
+    cur->table = table;
+    cur->page_num = entry->page_num;
+    cur->cell_num = entry->cell_num;
+    cur->end_of_table = false;
+    cur->view = NULL;
+    cur->page = NULL;
+    index->num_hits += 1;
+    return cur;
+}
+
+// Records that a descent found `key` at the cursor.
+void hash_index_record(hash_index_t* index, pager_t* pager, const void* key, cursor_t* cur) {
+    uint64_t page_commit_seq = pager->page_commit_seqs[cur->page_num];
+    if (pager->commit_seq < page_commit_seq) {
+        return;
+    }
+
+    uint64_t hash = hash_key(key);
+    hash_index_entry_t* entry = hash_index_bucket(index, hash);
+
+    if (entry->hash == hash) {
+        entry->hits += 1;
+    } else {
+        entry->hash = hash;
+        entry->hits = 1;
+    }
+    entry->page_num = cur->page_num;
+    entry->cell_num = cur->cell_num;
+    entry->page_commit_seq = page_commit_seq;
+}
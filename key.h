@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Keys are (tenant_id, id) pairs.
+ *
+ * On a page a key is stored big-endian, tenant_id first, so that memcmp order
+ * is the same as the numeric order of the pair.
+ */
+typedef struct {
+    uint64_t tenant_id;
+    uint64_t id;
+} row_key_t;
+
+const uint32_t KEY_TENANT_ID_SIZE = sizeof(uint64_t);
+const uint32_t KEY_ID_SIZE = sizeof(uint64_t);
+const uint32_t KEY_SIZE = KEY_TENANT_ID_SIZE + KEY_ID_SIZE;
+
+void encode_uint64(uint64_t value, uint8_t* dest) {
+    for (int32_t i = 7; 0 <= i; i--) {
+        dest[i] = (uint8_t)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+uint64_t decode_uint64(const uint8_t* src) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        value = (value << 8) | src[i];
+    }
+    return value;
+}
+
+void encode_key(const row_key_t* key, void* dest) {
+    encode_uint64(key->tenant_id, dest);
+    encode_uint64(key->id, (uint8_t*)dest + KEY_TENANT_ID_SIZE);
+}
+
+void decode_key(const void* src, row_key_t* key) {
+    key->tenant_id = decode_uint64(src);
+    key->id = decode_uint64((const uint8_t*)src + KEY_TENANT_ID_SIZE);
+}
+
+int compare_keys(const void* a, const void* b) {
+    return memcmp(a, b, KEY_SIZE);
+}
+
+uint64_t hash_key(const void* key) {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (uint32_t i = 0; i < KEY_SIZE; i++) {
+        hash ^= ((const uint8_t*)key)[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Same order as compare_keys, without encoding either key.
+int compare_row_keys(const row_key_t* a, const row_key_t* b) {
+    if (a->tenant_id != b->tenant_id) {
+        return a->tenant_id < b->tenant_id ? -1 : 1;
+    }
+    if (a->id != b->id) {
+        return a->id < b->id ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Separators
+ *
+ * Internal nodes store separators instead of full keys. A separator is a
+ * prefix of the left subtree's max key; the missing suffix reads as 0xff bytes,
+ * so every key in the left subtree is <= the separator.
+ */
+int compare_key_to_separator(const void* key, const void* separator, uint32_t separator_len) {
+    return memcmp(key, separator, separator_len);
+}
+
+// Length of the shortest prefix of `left` that still sorts below `right`.
+uint32_t separator_length(const void* left, const void* right) {
+    const uint8_t* l = left;
+    const uint8_t* r = right;
+    uint32_t i = 0;
+    while (i < KEY_SIZE - 1 && l[i] == r[i]) {
+        i++;
+    }
+    return i + 1;
+}
+
+void print_key(const void* key) {
+    row_key_t k;
+    decode_key(key, &k);
+    if (k.tenant_id == 0) {
+        printf("%llu", (unsigned long long)k.id);
+    } else {
+        printf("%llu:%llu", (unsigned long long)k.tenant_id, (unsigned long long)k.id);
+    }
+}
+
+void print_separator(const void* separator, uint32_t separator_len) {
+    if (separator_len == KEY_SIZE) {
+        print_key(separator);
+        return;
+    }
+    printf("0x");
+    for (uint32_t i = 0; i < separator_len; i++) {
+        printf("%02x", ((const uint8_t*)separator)[i]);
+    }
+    printf("..");
+}
@@ -1,3 +1,6 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
 #include <fcntl.h>
 #include <mhash.h>
 
@@ -35,13 +38,19 @@ void read_input(input_buffer_t* input) {
 }
 
 void print_row(row_t* row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+    if (row->tenant_id == 0) {
+        printf("(%llu, %s, %s)\n", (unsigned long long)row->id, row->username, row->email);
+    } else {
+        printf("(%llu:%llu, %s, %s)\n", (unsigned long long)row->tenant_id, (unsigned long long)row->id,
+               row->username, row->email);
+    }
 }
 
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } statement_type_t;
+typedef enum { STATEMENT_INSERT, STATEMENT_SELECT, STATEMENT_SELECT_KEY } statement_type_t;
 typedef struct {
     statement_type_t type;
     row_t row_to_insert;
+    row_key_t key_to_select;
 } statement_t;
 
 typedef enum {
@@ -52,6 +61,40 @@ typedef enum {
     PREPARE_SYNTAX_ERROR
 } prepare_result_t;
 
+prepare_result_t parse_uint64(char* str, uint64_t* value) {
+    if (str[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (!isdigit((unsigned char)str[0])) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long long parsed = strtoull(str, &end, 10);
+    if (*end != '\0' || errno == ERANGE) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *value = (uint64_t)parsed;
+    return PREPARE_SUCCESS;
+}
+
+// Parses "<id>" or "<tenant_id>:<id>".
+prepare_result_t parse_key(char* key_str, uint64_t* tenant_id, uint64_t* id) {
+    char* id_str = strchr(key_str, ':');
+    if (id_str == NULL) {
+        *tenant_id = 0;
+        return parse_uint64(key_str, id);
+    }
+
+    *id_str = '\0';
+    prepare_result_t result = parse_uint64(key_str, tenant_id);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    return parse_uint64(id_str + 1, id);
+}
+
 prepare_result_t prepare_insert(input_buffer_t* input, statement_t* st) {
     st->type = STATEMENT_INSERT;
     char* keyword = strtok(input->buffer, " ");
@@ -63,9 +106,11 @@ prepare_result_t prepare_insert(input_buffer_t* input, statement_t* st) {
         return PREPARE_SYNTAX_ERROR;
     }
 
-    int id = atoi(id_str);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
+    uint64_t tenant_id;
+    uint64_t id;
+    prepare_result_t result = parse_key(id_str, &tenant_id, &id);
+    if (result != PREPARE_SUCCESS) {
+        return result;
     }
     if (COLUMN_USERNAME_SIZE < strlen(username)) {
         return PREPARE_STRING_TOO_LONG;
@@ -74,34 +119,50 @@ prepare_result_t prepare_insert(input_buffer_t* input, statement_t* st) {
         return PREPARE_STRING_TOO_LONG;
     }
 
-    st->row_to_insert.id = (uint32_t)id;
+    st->row_to_insert.tenant_id = tenant_id;
+    st->row_to_insert.id = id;
     strcpy(st->row_to_insert.username, username);
     strcpy(st->row_to_insert.email, email);
     return PREPARE_SUCCESS;
 }
 
+prepare_result_t prepare_select(input_buffer_t* input, statement_t* st) {
+    st->type = STATEMENT_SELECT;
+    strtok(input->buffer, " ");  // Skip the keyword
+    char* key_str = strtok(NULL, " ");
+
+    if (key_str == NULL) {
+        return PREPARE_SUCCESS;
+    }
+
+    st->type = STATEMENT_SELECT_KEY;
+    return parse_key(key_str, &st->key_to_select.tenant_id, &st->key_to_select.id);
+}
+
 prepare_result_t prepare_statement(input_buffer_t* input, statement_t* st) {
     if (strncmp(input->buffer, "insert", 6) == 0) {
         return prepare_insert(input, st);
     }
     if (strncmp(input->buffer, "select", 6) == 0) {
-        st->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+        return prepare_select(input, st);
     }
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
 
+void* cursor_key(cursor_t* cursor) {
+    void* page = cursor_page(cursor);
+    return leaf_node_key(page, cursor->cell_num);
+}
+
 void* cursor_value(cursor_t* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
+    void* page = cursor_page(cursor);
     return leaf_node_value(page, cursor->cell_num);
 }
 
 // cursor_advance
 void cursor_next(cursor_t* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
+    void* page = cursor_page(cursor);
 
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*leaf_node_num_cells(page))) {
@@ -113,42 +174,129 @@ void cursor_next(cursor_t* cursor) {
         } else {
             cursor->page_num = next_page_num;
             cursor->cell_num = 0;
+            if (cursor->view != NULL) {
+                table_read_page(cursor->table, cursor->view, next_page_num, cursor->page);
+            }
         }
     }
 }
 
 typedef enum { EXECUTE_SUCCESS, EXECUTE_TABLE_FULL, EXECUTE_DUPLICATE_KEY } execute_result_t;
 
-execute_result_t execute_insert(statement_t* st, table_t* table) {
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
+// Buffers the row. Only keys the filter may have seen pay for the duplicate check's lookups.
+execute_result_t execute_buffered_insert(table_t* table, row_t* row, const void* key) {
+    memtable_t* memtable = table->memtable;
+
+    if (memtable_may_contain(memtable, key)) {
+        row_key_t row_key = {row->tenant_id, row->id};
+        if (memtable_find(memtable, &row_key) != NULL) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+        cursor_t* cur = table_find(table, key);
+        bool duplicate = cursor_at_key(cur, key);
+        free(cur);
+        if (duplicate) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
 
+    memtable_insert(memtable, row);
+    if (memtable_is_full(memtable)) {
+        table_drain_memtable(table);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+execute_result_t execute_insert(statement_t* st, table_t* table) {
     row_t* row = &(st->row_to_insert);
-    uint32_t key = row->id;
-    cursor_t* cur = table_find(table, key);
+    uint8_t key[KEY_SIZE];
+    row_key(row, key);
 
-    if (cur->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cur->cell_num);
-        if (key_at_index == key) {
-            return EXECUTE_DUPLICATE_KEY;
+    if (table->memtable != NULL) {
+        if (!table_can_buffer_row(table)) {
+            // Near the end of the file, rows go straight into the tree so a full table is reported.
+            table_drain_memtable(table);
+        }
+        if (table_can_buffer_row(table)) {
+            return execute_buffered_insert(table, row, key);
         }
     }
 
-    leaf_node_insert(cur, row->id, row);
+    cursor_t* cur = table_find(table, key);
+    if (cursor_at_key(cur, key)) {
+        free(cur);
+        return EXECUTE_DUPLICATE_KEY;
+    }
+    if (!cursor_has_room(cur)) {
+        free(cur);
+        return EXECUTE_TABLE_FULL;
+    }
+
+    leaf_node_insert(cur, key, row);
+    pager_commit(table->pager);
+    if (table->memtable != NULL) {
+        memtable_filter_add(table->memtable, key);
+    }
 
     free(cur);
     return EXECUTE_SUCCESS;
 }
 
 execute_result_t execute_select(statement_t* st, table_t* table) {
-    cursor_t* cur = table_start(table);
+    // Rows buffered after a snapshot was opened are newer than it.
+    read_view_t* view = table->read_view;
+    cursor_t* cur = table_start(table, view);
+    memtable_node_t* buffered = NULL;
+    if (table->memtable != NULL && view == NULL) {
+        buffered = memtable_first(table->memtable);
+    }
     row_t row;
-    while (!(cur->end_of_table)) {
+    while (!(cur->end_of_table) || buffered != NULL) {
+        // Merge buffered rows into the B-tree's key order.
+        bool take_buffered = buffered != NULL;
+        if (take_buffered && !(cur->end_of_table)) {
+            uint8_t buffered_key[KEY_SIZE];
+            row_key(&buffered->row, buffered_key);
+            take_buffered = compare_keys(buffered_key, cursor_key(cur)) < 0;
+        }
+
+        if (take_buffered) {
+            print_row(&buffered->row);
+            buffered = buffered->forward[0];
+        } else {
+            deserialize_row(cursor_value(cur), &row);
+            print_row(&row);
+            cursor_next(cur);
+        }
+    }
+    cursor_free(cur);
+    return EXECUTE_SUCCESS;
+}
+
+execute_result_t execute_select_key(statement_t* st, table_t* table) {
+    uint8_t key[KEY_SIZE];
+    encode_key(&st->key_to_select, key);
+
+    cursor_t* cur;
+    if (table->read_view != NULL) {
+        cur = table_descend_in_view(table, table->read_view, key);
+    } else {
+        if (table->memtable != NULL) {
+            row_t* buffered = memtable_find(table->memtable, &st->key_to_select);
+            if (buffered != NULL) {
+                print_row(buffered);
+                return EXECUTE_SUCCESS;
+            }
+        }
+        cur = table_find(table, key);
+    }
+
+    if (cursor_at_key(cur, key)) {
+        row_t row;
         deserialize_row(cursor_value(cur), &row);
         print_row(&row);
-        cursor_next(cur);
     }
-    free(cur);
+    cursor_free(cur);
     return EXECUTE_SUCCESS;
 }
 
@@ -158,6 +306,8 @@ execute_result_t execute_statement(statement_t* st, table_t* table) {
         return execute_insert(st, table);
     case (STATEMENT_SELECT):
         return execute_select(st, table);
+    case (STATEMENT_SELECT_KEY):
+        return execute_select_key(st, table);
     }
 }
 
@@ -170,6 +320,15 @@ void print_constants() {
     printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
 }
 
+void print_stats(table_t* table) {
+    printf("PAGES_WARMED: %d\n", table->pager->num_pages_warmed);
+    printf("PAGE_READS: %d\n", table->pager->num_page_reads);
+    printf("PAGE_VERSIONS: %d\n", table->pager->num_versions);
+    if (table->hash_index != NULL) {
+        printf("HASH_INDEX_HITS: %d\n", table->hash_index->num_hits);
+    }
+}
+
 void indent(uint32_t level) {
     for (uint32_t i = 0; i < level; i++) {
         printf("  ");
@@ -187,7 +346,9 @@ void print_tree(pager_t* pager, uint32_t page_num, uint32_t indentation_level) {
             printf("- leaf (size %d)\n", num_keys);
             for (uint32_t i = 0; i < num_keys; i++) {
                 indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
+                printf("- ");
+                print_key(leaf_node_key(node, i));
+                printf("\n");
             }
             break;
         }
@@ -201,7 +362,9 @@ void print_tree(pager_t* pager, uint32_t page_num, uint32_t indentation_level) {
                 print_tree(pager, child, indentation_level + 1);
 
                 indent(indentation_level);
-                printf("- key %d\n", *internal_node_key(node, i));
+                printf("- key ");
+                print_separator(internal_node_key(node, i), *internal_node_key_len(node, i));
+                printf("\n");
             }
             uint32_t child = *internal_node_right_child(node);
             print_tree(pager, child, indentation_level + 1);
@@ -220,29 +383,105 @@ meta_command_result_t do_meta_command(input_buffer_t* input, table_t* table) {
         printf("Constants:\n");
         print_constants();
         return META_COMMAND_SUCCESS;
+    } else if (strcmp(input->buffer, ".stats") == 0) {
+        // Let warm-up finish so the counts do not depend on timing.
+        pager_warmup_finish(table->pager);
+        printf("Stats:\n");
+        print_stats(table);
+        return META_COMMAND_SUCCESS;
     } else if (strcmp(input->buffer, ".btree") == 0) {
         printf("Tree:\n");
         print_tree(table->pager, 0, 0);
         return META_COMMAND_SUCCESS;
+    } else if (strncmp(input->buffer, ".backup ", 8) == 0) {
+        // The snapshot only covers the B-tree.
+        table_drain_memtable(table);
+        switch (backup_start(table, input->buffer + 8)) {
+        case (BACKUP_SUCCESS):
+            printf("Backup started.\n");
+            break;
+        case (BACKUP_IN_PROGRESS):
+            printf("Error: Backup already in progress.\n");
+            break;
+        case (BACKUP_OPEN_FAILED):
+            printf("Error: Unable to open backup file.\n");
+            break;
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input->buffer, ".snapshot") == 0) {
+        // Like .backup, the snapshot only covers the B-tree.
+        if (table->read_view != NULL) {
+            printf("Error: Snapshot already open.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        table_drain_memtable(table);
+        table->read_view = pager_open_read_view(table->pager);
+        printf("Snapshot opened.\n");
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input->buffer, ".release") == 0) {
+        if (table->read_view == NULL) {
+            printf("Error: No snapshot open.\n");
+            return META_COMMAND_SUCCESS;
+        }
+        pager_close_read_view(table->pager, table->read_view);
+        table->read_view = NULL;
+        printf("Snapshot released.\n");
+        return META_COMMAND_SUCCESS;
     } else {
         return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    pager_mode_t mode = PAGER_BUFFERED;
+    bool use_hash_index = false;
+    uint32_t page_writer_rate = 0;
+    uint32_t memtable_rows = 0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--direct-io") == 0) {
+            mode = PAGER_DIRECT;
+        } else if (strcmp(argv[arg], "--mmap") == 0) {
+            mode = PAGER_MMAP;
+        } else if (strcmp(argv[arg], "--adaptive-hash-index") == 0) {
+            use_hash_index = true;
+        } else if (strcmp(argv[arg], "--memtable") == 0) {
+            memtable_rows = MEMTABLE_DEFAULT_MAX_ROWS;
+        } else if (strncmp(argv[arg], "--memtable=", 11) == 0 && 0 < atoi(argv[arg] + 11)) {
+            memtable_rows = (uint32_t)atoi(argv[arg] + 11);
+        } else if (strcmp(argv[arg], "--page-writer") == 0) {
+            page_writer_rate = PAGE_WRITER_DEFAULT_PAGES_PER_SECOND;
+        } else if (strncmp(argv[arg], "--page-writer=", 14) == 0 && 0 < atoi(argv[arg] + 14)) {
+            page_writer_rate = (uint32_t)atoi(argv[arg] + 14);
+        } else {
+            printf("Unrecognized option '%s'.\n", argv[arg]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc <= arg) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
 
-    char* filename = argv[1];
-    table_t* table = db_open(filename);
+    char* filename = argv[arg];
+    table_t* table = db_open(filename, mode);
+    if (use_hash_index) {
+        table->hash_index = hash_index_new();
+    }
+    if (0 < page_writer_rate) {
+        pager_writer_start(table->pager, page_writer_rate);
+    }
+    if (0 < memtable_rows) {
+        table_attach_memtable(table, memtable_rows);
+    }
 
     input_buffer_t* input = new_input_buffer();
 
     while (true) {
         print_prompt();
         read_input(input);
+        backup_poll(table);
 
         if (input->buffer[0] == '.') {
             switch (do_meta_command(input, table)) {
@@ -266,7 +505,7 @@ int main(int argc, char* argv[]) {
             continue;
         case (PREPARE_SYNTAX_ERROR):
             printf("Syntax error. Could not parse statement.\n");
-            break;
+            continue;
         case (PREPARE_UNRECOGNIZED_STATEMENT):
             printf("Unrecognized keyword at start of '%s'.\n", input->buffer);
             continue;
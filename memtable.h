@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stdint.h>
+#include "key.h"
+#include "row.h"
+#include "values.h"
+
+/*
+ * Memtable
+ *
+ * A skip list of rows ordered by key that absorbs inserts in memory. It is
+ * drained into the B-tree in key order when it fills up and on close.
+ *
+ * A Bloom filter over all keys in the memtable and the B-tree lets an insert of
+ * a new key skip the duplicate check's descent to its leaf. Keys are never
+ * deleted, so the filter is only ever added to.
+ */
+const uint32_t MEMTABLE_MAX_LEVEL = 12;
+const uint32_t MEMTABLE_DEFAULT_MAX_ROWS = 1024;
+const uint32_t MEMTABLE_FILTER_BITS = 1 << 15;  // Must be a power of two
+const uint32_t MEMTABLE_FILTER_HASHES = 4;
+
+memtable_node_t* memtable_new_node(uint32_t level) {
+    memtable_node_t* node = malloc(sizeof(memtable_node_t) + level * sizeof(memtable_node_t*));
+    for (uint32_t i = 0; i < level; i++) {
+        node->forward[i] = NULL;
+    }
+    return node;
+}
+
+memtable_t* memtable_new(uint32_t max_rows) {
+    memtable_t* memtable = malloc(sizeof(memtable_t));
+    memtable->head = memtable_new_node(MEMTABLE_MAX_LEVEL);
+    memtable->key_filter = calloc(MEMTABLE_FILTER_BITS / 8, 1);
+    memtable->level = 1;
+    memtable->num_rows = 0;
+    memtable->max_rows = max_rows;
+    memtable->random_state = 0x9e3779b97f4a7c15ULL;
+    return memtable;
+}
+
+// Drops every row, keeping the memtable ready for reuse.
+void memtable_clear(memtable_t* memtable) {
+    memtable_node_t* node = memtable->head->forward[0];
+    while (node != NULL) {
+        memtable_node_t* next = node->forward[0];
+        free(node);
+        node = next;
+    }
+    for (uint32_t i = 0; i < MEMTABLE_MAX_LEVEL; i++) {
+        memtable->head->forward[i] = NULL;
+    }
+    memtable->level = 1;
+    memtable->num_rows = 0;
+}
+
+// Drops the row with the smallest key.
+void memtable_remove_first(memtable_t* memtable) {
+    memtable_node_t* node = memtable->head->forward[0];
+    if (node == NULL) {
+        return;
+    }
+    // The first node is first on every level it is on.
+    for (uint32_t i = 0; i < memtable->level && memtable->head->forward[i] == node; i++) {
+        memtable->head->forward[i] = node->forward[i];
+    }
+    free(node);
+    memtable->num_rows -= 1;
+}
+
+void memtable_free(memtable_t* memtable) {
+    memtable_clear(memtable);
+    free(memtable->key_filter);
+    free(memtable->head);
+    free(memtable);
+}
+
+// Bit `i` of the filter for the key with `hash`, by double hashing.
+uint32_t memtable_filter_bit(uint64_t hash, uint32_t i) {
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    return (h1 + i * h2) & (MEMTABLE_FILTER_BITS - 1);
+}
+
+void memtable_filter_add(memtable_t* memtable, const void* key) {
+    uint64_t hash = hash_key(key);
+    for (uint32_t i = 0; i < MEMTABLE_FILTER_HASHES; i++) {
+        uint32_t bit = memtable_filter_bit(hash, i);
+        memtable->key_filter[bit / 8] |= (uint8_t)(1 << (bit % 8));
+    }
+}
+
+// False means `key` is in neither the memtable nor the B-tree.
+bool memtable_may_contain(memtable_t* memtable, const void* key) {
+    uint64_t hash = hash_key(key);
+    for (uint32_t i = 0; i < MEMTABLE_FILTER_HASHES; i++) {
+        uint32_t bit = memtable_filter_bit(hash, i);
+        if ((memtable->key_filter[bit / 8] & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool memtable_is_full(memtable_t* memtable) {
+    return memtable->max_rows <= memtable->num_rows;
+}
+
+memtable_node_t* memtable_first(memtable_t* memtable) {
+    return memtable->head->forward[0];
+}
+
+int compare_row_to_key(row_t* row, const row_key_t* key) {
+    row_key_t row_key = {row->tenant_id, row->id};
+    return compare_row_keys(&row_key, key);
+}
+
+// Each level holds about a quarter of the nodes of the level below.
+uint32_t memtable_random_level(memtable_t* memtable) {
+    uint32_t level = 1;
+    while (level < MEMTABLE_MAX_LEVEL) {
+        memtable->random_state ^= memtable->random_state << 13;
+        memtable->random_state ^= memtable->random_state >> 7;
+        memtable->random_state ^= memtable->random_state << 17;
+        if ((memtable->random_state & 3) != 0) {
+            break;
+        }
+        level++;
+    }
+    return level;
+}
+
+// Fills `update` with the last node before `key` on every level and returns the node at or after it.
+memtable_node_t* memtable_seek(memtable_t* memtable, const row_key_t* key, memtable_node_t** update) {
+    memtable_node_t* node = memtable->head;
+    for (int32_t i = memtable->level - 1; 0 <= i; i--) {
+        while (node->forward[i] != NULL && compare_row_to_key(&node->forward[i]->row, key) < 0) {
+            node = node->forward[i];
+        }
+        if (update != NULL) {
+            update[i] = node;
+        }
+    }
+    return node->forward[0];
+}
+
+row_t* memtable_find(memtable_t* memtable, const row_key_t* key) {
+    memtable_node_t* node = memtable_seek(memtable, key, NULL);
+    if (node != NULL && compare_row_to_key(&node->row, key) == 0) {
+        return &node->row;
+    }
+    return NULL;
+}
+
+// Returns false if a row with the same key is already buffered.
+bool memtable_insert(memtable_t* memtable, row_t* row) {
+    row_key_t key = {row->tenant_id, row->id};
+    memtable_node_t* update[MEMTABLE_MAX_LEVEL];
+    memtable_node_t* next = memtable_seek(memtable, &key, update);
+    if (next != NULL && compare_row_to_key(&next->row, &key) == 0) {
+        return false;
+    }
+
+    uint32_t level = memtable_random_level(memtable);
+    for (uint32_t i = memtable->level; i < level; i++) {
+        update[i] = memtable->head;
+    }
+    if (memtable->level < level) {
+        memtable->level = level;
+    }
+
+    memtable_node_t* node = memtable_new_node(level);
+    node->row = *row;
+    uint8_t encoded_key[KEY_SIZE];
+    encode_key(&key, encoded_key);
+    memtable_filter_add(memtable, encoded_key);
+    for (uint32_t i = 0; i < level; i++) {
+        node->forward[i] = update[i]->forward[i];
+        update[i]->forward[i] = node;
+    }
+    memtable->num_rows += 1;
+    return true;
+}
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 
+#include "key.h"
 #include "page.h"
 
 typedef enum { NODE_INTERNAL, NODE_LEAF } node_type_t;
@@ -33,7 +34,7 @@ const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_C
 /*
  * Leaf Node BodyLayout
  */
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_SIZE = KEY_SIZE;
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
 const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_SIZE + LEAF_NODE_KEY_OFFSET;
@@ -51,12 +52,27 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_KEY_HEAP_START_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_HEAP_START_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE +
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE + INTERNAL_NODE_KEY_HEAP_START_SIZE;
 
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+/*
+ * Internal Node Body Layout
+ *
+ * Cells are fixed-size slots growing from the header: (child, key offset, key length).
+ * Separator bytes are variable length and packed into a key heap that grows down
+ * from the end of the page.
+ */
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_CHILD_SIZE;
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+const uint32_t INTERNAL_NODE_KEY_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t INTERNAL_NODE_KEY_OFFSET_OFFSET = INTERNAL_NODE_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_KEY_LEN_SIZE = sizeof(uint16_t);
+const uint32_t INTERNAL_NODE_KEY_LEN_OFFSET = INTERNAL_NODE_KEY_OFFSET_OFFSET + INTERNAL_NODE_KEY_OFFSET_SIZE;
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_OFFSET_SIZE + INTERNAL_NODE_KEY_LEN_SIZE;
+// An internal node is full once it lacks room for another cell and separator, plus
+// enough spare heap for one existing separator to regrow to full length.
+const uint32_t INTERNAL_NODE_MIN_FREE_SPACE = INTERNAL_NODE_CELL_SIZE + 2 * KEY_SIZE;
 
 node_type_t get_node_type(void* node) {
     uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
@@ -76,7 +92,7 @@ void* leaf_node_cell(void* node, uint32_t cell_num) {
     return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
 }
 
-uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
+void* leaf_node_key(void* node, uint32_t cell_num) {
     return leaf_node_cell(node, cell_num);
 }
 
@@ -121,17 +137,65 @@ uint32_t* internal_node_child(void* node, uint32_t child_num) {
     }
 }
 
-uint32_t* internal_node_key(void* node, uint32_t key_num) {
-    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+uint16_t* internal_node_key_offset(void* node, uint32_t key_num) {
+    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_KEY_OFFSET_OFFSET;
+}
+
+uint16_t* internal_node_key_len(void* node, uint32_t key_num) {
+    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_KEY_LEN_OFFSET;
+}
+
+void* internal_node_key(void* node, uint32_t key_num) {
+    return node + *internal_node_key_offset(node, key_num);
+}
+
+uint32_t* internal_node_key_heap_start(void* node) {
+    return node + INTERNAL_NODE_KEY_HEAP_START_OFFSET;
+}
+
+uint32_t internal_node_free_space(void* node) {
+    uint32_t cells_end = INTERNAL_NODE_HEADER_SIZE + *internal_node_num_keys(node) * INTERNAL_NODE_CELL_SIZE;
+    return *internal_node_key_heap_start(node) - cells_end;
 }
 
-uint32_t get_node_max_key(void* node) {
-    switch (get_node_type(node)) {
-        case NODE_INTERNAL:
-            return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-        case NODE_LEAF:
-            return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// Rewrites the key heap so that it holds only the separators of live cells.
+void internal_node_compact_keys(void* node) {
+    uint8_t heap[PAGE_SIZE];
+    uint32_t heap_start = PAGE_SIZE;
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+        uint16_t len = *internal_node_key_len(node, i);
+        heap_start -= len;
+        memcpy(heap + heap_start, internal_node_key(node, i), len);
+        *internal_node_key_offset(node, i) = (uint16_t)heap_start;
+    }
+    memcpy(node + heap_start, heap + heap_start, PAGE_SIZE - heap_start);
+    *internal_node_key_heap_start(node) = heap_start;
+}
+
+void internal_node_set_key(void* node, uint32_t key_num, const void* key, uint32_t key_len) {
+    if (key_len <= *internal_node_key_len(node, key_num)) {
+        // Shorter separators overwrite the old one in place.
+        memcpy(internal_node_key(node, key_num), key, key_len);
+        *internal_node_key_len(node, key_num) = (uint16_t)key_len;
+        return;
     }
+
+    *internal_node_key_len(node, key_num) = 0;
+    if (internal_node_free_space(node) < key_len) {
+        internal_node_compact_keys(node);
+    }
+    if (internal_node_free_space(node) < key_len) {
+        printf("Internal node has no room for a %d byte key\n", key_len);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t heap_start = *internal_node_key_heap_start(node) - key_len;
+    memcpy(node + heap_start, key, key_len);
+    *internal_node_key_heap_start(node) = heap_start;
+    *internal_node_key_offset(node, key_num) = (uint16_t)heap_start;
+    *internal_node_key_len(node, key_num) = (uint16_t)key_len;
 }
 
 bool is_node_root(void* node) {
@@ -148,6 +212,7 @@ void initialize_internal_node(void* node) {
     set_node_type(node, NODE_INTERNAL);
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
+    *internal_node_key_heap_start(node) = PAGE_SIZE;
 }
 
 uint32_t* node_parent(void* node) {
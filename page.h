@@ -6,21 +6,323 @@
 
 #include <stdint.h>
 #include <mhash.h>
+#include <sys/mman.h>
+#include <time.h>
 #include "row.h"
 #include "values.h"
 
 const uint32_t PAGE_SIZE = 4096;
+const size_t PAGER_ARENA_ALIGNMENT = 2 * 1024 * 1024;  // One huge page
 
+// Maps an anonymous region of `size` bytes, backed by huge pages where the system allows it.
+void* pager_map_arena(size_t size) {
+#ifdef MAP_HUGETLB
+    void* arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena != MAP_FAILED) {
+        return arena;
+    }
+#endif
+
+    // No explicit huge pages reserved. Over-map so the arena can start on a huge page
+    // boundary, and let transparent huge pages back it.
+    size_t mapped_size = size + PAGER_ARENA_ALIGNMENT;
+    void* mapped = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        printf("Error allocating page arena: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    uintptr_t start = ((uintptr_t)mapped + PAGER_ARENA_ALIGNMENT - 1) & ~(PAGER_ARENA_ALIGNMENT - 1);
+    size_t head = start - (uintptr_t)mapped;
+    size_t tail = mapped_size - head - size;
+    if (head) {
+        munmap(mapped, head);
+    }
+    if (tail) {
+        munmap((void*)(start + size), tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise((void*)start, size, MADV_HUGEPAGE);
+#endif
+    return (void*)start;
+}
+
+/*
+ * Memory-mapped pages
+ *
+ * The arena maps all TABLE_MAX_PAGES pages of the file up front, so page
+ * pointers never move. Touching a page past the end of the file would fault,
+ * so the file is grown MMAP_GROW_PAGES at a time ahead of use and trimmed back
+ * to num_pages on close.
+ */
+const uint32_t MMAP_GROW_PAGES = 16;
+
+void pager_mmap_grow(pager_t* pager, uint32_t page_num) {
+    if ((off_t)(page_num + 1) * PAGE_SIZE <= pager->file_length) {
+        return;
+    }
+
+    uint32_t num_pages = (page_num / MMAP_GROW_PAGES + 1) * MMAP_GROW_PAGES;
+    if (TABLE_MAX_PAGES < num_pages) {
+        num_pages = TABLE_MAX_PAGES;
+    }
+    off_t file_length = (off_t)num_pages * PAGE_SIZE;
+    if (ftruncate(pager->file_descriptor, file_length) == -1) {
+        printf("Error growing file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = file_length;
+}
+
+bool page_is_zeroed(const void* page) {
+    const uint64_t* words = page;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (words[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * A session that exits without db_close leaves the grown tail in the file. No
+ * page in use is all zeroes (every node has a type, a cell count or keys), so
+ * zeroed pages at the end are padding. Cuts them off and returns the new length.
+ */
+off_t pager_trim_padding(int fd, off_t file_length) {
+    void* page = NULL;
+    if (posix_memalign(&page, PAGE_SIZE, PAGE_SIZE) != 0) {
+        printf("Unable to allocate page\n");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t trimmed_length = file_length;
+    while (PAGE_SIZE <= trimmed_length) {
+        ssize_t bytes_read = pread(fd, page, PAGE_SIZE, trimmed_length - PAGE_SIZE);
+        if (bytes_read == -1) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (!page_is_zeroed(page)) {
+            break;
+        }
+        trimmed_length -= PAGE_SIZE;
+    }
+    free(page);
+
+    if (trimmed_length != file_length && ftruncate(fd, trimmed_length) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return trimmed_length;
+}
+
+// Tells the kernel how the mapping is about to be read. Only calls madvise when the hint changes.
+void pager_advise(pager_t* pager, int advice) {
+    if (pager->mode != PAGER_MMAP || pager->arena_advice == advice) {
+        return;
+    }
+    madvise(pager->arena, pager->arena_size, advice);
+    pager->arena_advice = advice;
+}
+
+// Writes back the dirty part of pages [first_page_num, first_page_num + num_pages) of the mapping.
+void pager_msync(pager_t* pager, uint32_t first_page_num, uint32_t num_pages) {
+    if (num_pages == 0) {
+        return;
+    }
+    if (msync(pager->arena + (size_t)first_page_num * PAGE_SIZE, (size_t)num_pages * PAGE_SIZE, MS_SYNC) == -1) {
+        printf("Error syncing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void* pager_alloc_page(pager_t* pager, uint32_t page_num) {
+    switch (pager->mode) {
+    case PAGER_BUFFERED:
+        return malloc(PAGE_SIZE);
+    case PAGER_DIRECT:
+        return pager->arena + (size_t)page_num * PAGE_SIZE;
+    case PAGER_MMAP:
+        pager_mmap_grow(pager, page_num);
+        return pager->arena + (size_t)page_num * PAGE_SIZE;
+    }
+    printf("Unknown pager mode %d\n", pager->mode);
+    exit(EXIT_FAILURE);
+}
+
+void pager_free_page(pager_t* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_BUFFERED) {
+        free(pager->pages[page_num]);
+    }
+    pager->pages[page_num] = NULL;
+}
+
+// Takes the pager lock if a background thread may be using the page table.
+bool pager_lock_if_shared(pager_t* pager) {
+    if (pager->num_reader_threads == 0 && pager->warmup == NULL && pager->writer == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&pager->lock);
+    return true;
+}
+
+/*
+ * Cache warm-up
+ *
+ * db_close records which pages were resident in a small sidecar file. The next
+ * pager_open preloads those pages on a background thread, coalescing adjacent
+ * page numbers into one large read. Pages the foreground has already loaded by
+ * then are left alone.
+ */
+const uint32_t WARMUP_MAX_RUN_PAGES = 32;
+const uint32_t WARMUP_FILE_MAGIC = 0x5742444c;  // "LDBW" in little-endian
+
+void* pager_warmup_run(void* arg) {
+    pager_t* pager = arg;
+    pager_warmup_t* warmup = pager->warmup;
+
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, PAGE_SIZE, WARMUP_MAX_RUN_PAGES * PAGE_SIZE) != 0) {
+        buffer = NULL;
+    }
+
+    uint32_t i = 0;
+    while (buffer != NULL && i < warmup->num_page_nums) {
+        uint32_t first_page_num = warmup->page_nums[i];
+        uint32_t run = 1;
+        while (i + run < warmup->num_page_nums && run < WARMUP_MAX_RUN_PAGES &&
+               warmup->page_nums[i + run] == first_page_num + run) {
+            run++;
+        }
+
+        ssize_t bytes_read =
+            pread(pager->file_descriptor, buffer, (size_t)run * PAGE_SIZE, (off_t)first_page_num * PAGE_SIZE);
+        uint32_t pages_read = bytes_read > 0 ? (uint32_t)(bytes_read / PAGE_SIZE) : 0;
+
+        pthread_mutex_lock(&pager->lock);
+        for (uint32_t j = 0; j < pages_read; j++) {
+            uint32_t page_num = first_page_num + j;
+            if (pager->pages[page_num] == NULL) {
+                void* page = pager_alloc_page(pager, page_num);
+                memcpy(page, buffer + (size_t)j * PAGE_SIZE, PAGE_SIZE);
+                pager->pages[page_num] = page;
+                pager->num_pages_warmed += 1;
+            }
+        }
+        pthread_mutex_unlock(&pager->lock);
+
+        i += run;
+    }
+    free(buffer);
+
+    pthread_mutex_lock(&pager->lock);
+    warmup->done = true;
+    pthread_mutex_unlock(&pager->lock);
+    return NULL;
+}
+
+int compare_page_nums(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Starts preloading the pages listed in `path`. A missing or malformed file is ignored.
+void pager_warmup_start(pager_t* pager, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return;
+    }
+
+    uint32_t header[2];
+    if (fread(header, sizeof(uint32_t), 2, file) != 2 || header[0] != WARMUP_FILE_MAGIC ||
+        TABLE_MAX_PAGES < header[1]) {
+        fclose(file);
+        return;
+    }
+
+    uint32_t* page_nums = malloc(sizeof(uint32_t) * (header[1] + 1));
+    uint32_t count = (uint32_t)fread(page_nums, sizeof(uint32_t), header[1], file);
+    fclose(file);
+
+    // Only pages that exist in the file are worth reading.
+    qsort(page_nums, count, sizeof(uint32_t), compare_page_nums);
+    uint32_t num_page_nums = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (page_nums[i] < pager->num_pages && (num_page_nums == 0 || page_nums[num_page_nums - 1] != page_nums[i])) {
+            page_nums[num_page_nums++] = page_nums[i];
+        }
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        // The kernel can read ahead into the mapping itself; no thread needed.
+        for (uint32_t i = 0; i < num_page_nums; i++) {
+            madvise(pager->arena + (size_t)page_nums[i] * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+        }
+        num_page_nums = 0;
+    }
+    if (num_page_nums == 0) {
+        free(page_nums);
+        return;
+    }
+
+    pager_warmup_t* warmup = malloc(sizeof(pager_warmup_t));
+    warmup->page_nums = page_nums;
+    warmup->num_page_nums = num_page_nums;
+    warmup->done = false;
+    pager->warmup = warmup;
+
+    if (pthread_create(&warmup->thread, NULL, pager_warmup_run, pager) != 0) {
+        free(page_nums);
+        free(warmup);
+        pager->warmup = NULL;
+    }
+}
+
+// Waits for the warm-up thread, if any.
+void pager_warmup_finish(pager_t* pager) {
+    pager_warmup_t* warmup = pager->warmup;
+    if (warmup == NULL) {
+        return;
+    }
+    pthread_join(warmup->thread, NULL);
+    free(warmup->page_nums);
+    free(warmup);
+    pager->warmup = NULL;
+}
+
+// Writes the numbers of all resident pages to `path` for the next pager_warmup_start.
+void pager_warmup_dump(pager_t* pager, const char* path) {
+    uint32_t page_nums[TABLE_MAX_PAGES];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        if (pager->pages[i] != NULL) {
+            page_nums[count++] = i;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return;
+    }
+    uint32_t header[2] = {WARMUP_FILE_MAGIC, count};
+    fwrite(header, sizeof(uint32_t), 2, file);
+    fwrite(page_nums, sizeof(uint32_t), count, file);
+    fclose(file);
+}
 
 void* get_page(pager_t* pager, uint32_t page_num) {
-    if (TABLE_MAX_PAGES < page_num) {
+    if (TABLE_MAX_PAGES <= page_num) {
         printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
         exit(EXIT_FAILURE);
     }
 
+    bool shared = pager_lock_if_shared(pager);
+
     if (pager->pages[page_num] == NULL) {
         // Cache miss. Allocate memory and load from file.
-        void* page = malloc(PAGE_SIZE);
+        void* page = pager_alloc_page(pager, page_num);
         uint32_t num_pages = (uint32_t)(pager->file_length / PAGE_SIZE);
 
         // We might save a partial page at the end of the file
@@ -28,13 +330,17 @@ void* get_page(pager_t* pager, uint32_t page_num) {
             num_pages += 1;
         }
 
-        if (page_num <= num_pages) {
+        // A mapped page already shows the file's contents.
+        if (pager->mode != PAGER_MMAP && page_num <= num_pages) {
             lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
             ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
             if (bytes_read == -1) {
                 printf("Error reading file: %d\n", errno);
                 exit(EXIT_FAILURE);
             }
+            if (0 < bytes_read) {
+                pager->num_page_reads += 1;
+            }
         }
 
         pager->pages[page_num] = page;
@@ -44,30 +350,458 @@ void* get_page(pager_t* pager, uint32_t page_num) {
         }
     }
 
-    return pager->pages[page_num];
+    void* page = pager->pages[page_num];
+    bool warmed_up = pager->warmup != NULL && pager->warmup->done;
+    if (shared) {
+        pthread_mutex_unlock(&pager->lock);
+    }
+    if (warmed_up) {
+        pager_warmup_finish(pager);
+    }
+    return page;
+}
+
+/*
+ * Background page writer
+ *
+ * Every page write marks the page dirty. The writer thread wakes every
+ * PAGE_WRITER_INTERVAL_MS and writes dirty pages back in page-number order,
+ * resuming where the last sweep stopped, at pages_per_second. Once
+ * PAGE_WRITER_DIRTY_PERCENT of the pages are dirty it is woken early and
+ * writes all of them. Each sweep ends with an fsync, and db_close only has to
+ * write what changed since the last sweep.
+ *
+ * The foreground holds transaction_lock from its first page write until
+ * pager_commit, and a sweep holds it until its last page is written, so every
+ * page it writes comes from the same statement boundary. Only a sweep that
+ * writes every dirty page leaves the whole file at that boundary; rate-limited
+ * sweeps just trickle pages out. In PAGER_MMAP mode the kernel may also write
+ * mapped pages back at any time, mid-statement or not.
+ */
+const uint32_t PAGE_WRITER_INTERVAL_MS = 100;
+const uint32_t PAGE_WRITER_DEFAULT_PAGES_PER_SECOND = 1000;
+const uint32_t PAGE_WRITER_DIRTY_PERCENT = 50;
+const uint32_t PAGE_WRITER_BATCH_PAGES = 32;
+
+void pager_mark_clean(pager_t* pager, uint32_t page_num) {
+    if (pager->dirty[page_num]) {
+        pager->dirty[page_num] = false;
+        pager->num_dirty -= 1;
+    }
 }
 
-pager_t* pager_open(const char* filename) {
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+// Writes pages [first_page_num, first_page_num + num_pages) from `src` with one write. Safe to call from another thread.
+void pager_write_pages(pager_t* pager, uint32_t first_page_num, uint32_t num_pages, void* src) {
+    if (pager->mode == PAGER_MMAP) {
+        pager_msync(pager, first_page_num, num_pages);
+        return;
+    }
+    ssize_t bytes_written = pwrite(pager->file_descriptor, src, (size_t)num_pages * PAGE_SIZE,
+                                   (off_t)first_page_num * PAGE_SIZE);
+    if (bytes_written == -1) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Copies up to `max_pages` dirty pages below `end_page_num`, in page-number order
+ * from next_page_num, into `buffer` and marks them clean. Returns the number copied.
+ * Caller holds transaction_lock.
+ */
+uint32_t pager_writer_collect(pager_t* pager, uint32_t end_page_num, uint32_t max_pages, uint32_t* page_nums,
+                              void* buffer) {
+    pager_writer_t* writer = pager->writer;
+    uint32_t count = 0;
+
+    pthread_mutex_lock(&pager->lock);
+    uint32_t page_num = writer->next_page_num;
+    for (; page_num < end_page_num && page_num < pager->num_pages && count < max_pages; page_num++) {
+        if (!pager->dirty[page_num]) {
+            continue;
+        }
+        // A mapped page is written straight from the mapping.
+        if (pager->mode != PAGER_MMAP) {
+            memcpy(buffer + (size_t)count * PAGE_SIZE, pager->pages[page_num], PAGE_SIZE);
+        }
+        pager_mark_clean(pager, page_num);
+        page_nums[count++] = page_num;
+    }
+    writer->next_page_num = page_num < pager->num_pages ? page_num : 0;
+    pthread_mutex_unlock(&pager->lock);
+
+    return count;
+}
+
+// Writes up to `budget` dirty pages, visiting each page at most once. Returns the number written.
+uint32_t pager_writer_sweep(pager_t* pager, uint32_t budget, uint32_t* page_nums, void* buffer) {
+    pthread_mutex_lock(&pager->writer->transaction_lock);
+    uint32_t start_page_num = pager->writer->next_page_num;
+    uint32_t end_page_num = TABLE_MAX_PAGES;
+    uint32_t written = 0;
+    while (written < budget) {
+        uint32_t max_pages = budget - written < PAGE_WRITER_BATCH_PAGES ? budget - written : PAGE_WRITER_BATCH_PAGES;
+        uint32_t count = pager_writer_collect(pager, end_page_num, max_pages, page_nums, buffer);
+
+        // Coalesce adjacent page numbers into one write.
+        uint32_t run_start = 0;
+        for (uint32_t i = 1; i <= count; i++) {
+            if (i == count || page_nums[i] != page_nums[i - 1] + 1) {
+                pager_write_pages(pager, page_nums[run_start], i - run_start, buffer + (size_t)run_start * PAGE_SIZE);
+                run_start = i;
+            }
+        }
+        written += count;
+
+        uint32_t next_page_num = pager->writer->next_page_num;
+        if (next_page_num == 0 && end_page_num == TABLE_MAX_PAGES && start_page_num != 0) {
+            // Started part way through the file. Go on with the pages before the starting point.
+            end_page_num = start_page_num;
+        } else if (next_page_num == 0 || end_page_num <= next_page_num) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pager->writer->transaction_lock);
+
+    if (0 < written && pager->mode != PAGER_MMAP && fsync(pager->file_descriptor) == -1) {
+        printf("Error syncing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return written;
+}
+
+void* pager_writer_run(void* arg) {
+    pager_t* pager = arg;
+    pager_writer_t* writer = pager->writer;
+
+    uint32_t page_nums[PAGE_WRITER_BATCH_PAGES];
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, PAGE_SIZE, (size_t)PAGE_WRITER_BATCH_PAGES * PAGE_SIZE) != 0) {
+        printf("Unable to allocate page writer buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    // A sweep never has more than TABLE_MAX_PAGES pages to write.
+    uint64_t pages_per_sweep = (uint64_t)writer->pages_per_second * PAGE_WRITER_INTERVAL_MS / 1000;
+    if (pages_per_sweep == 0) {
+        pages_per_sweep = 1;
+    } else if (TABLE_MAX_PAGES < pages_per_sweep) {
+        pages_per_sweep = TABLE_MAX_PAGES;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    while (!writer->stop) {
+        if (!writer->urgent) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)PAGE_WRITER_INTERVAL_MS * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&writer->wake, &pager->lock, &deadline);
+        }
+        if (writer->stop) {
+            break;
+        }
+        uint32_t budget = writer->urgent ? TABLE_MAX_PAGES : (uint32_t)pages_per_sweep;
+        writer->urgent = false;
+        pthread_mutex_unlock(&pager->lock);
+
+        pager_writer_sweep(pager, budget, page_nums, buffer);
+
+        pthread_mutex_lock(&pager->lock);
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    free(buffer);
+    return NULL;
+}
+
+void pager_writer_start(pager_t* pager, uint32_t pages_per_second) {
+    pager_writer_t* writer = malloc(sizeof(pager_writer_t));
+    pthread_mutex_init(&writer->transaction_lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    writer->pages_per_second = pages_per_second;
+    writer->next_page_num = 0;
+    writer->urgent = false;
+    writer->stop = false;
+
+    pager->writer = writer;
+    if (pthread_create(&writer->thread, NULL, pager_writer_run, pager) != 0) {
+        printf("Unable to start page writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Stops the writer after its current sweep. Pages it has not reached stay dirty.
+void pager_writer_stop(pager_t* pager) {
+    pager_writer_t* writer = pager->writer;
+    if (writer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    writer->stop = true;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&pager->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_cond_destroy(&writer->wake);
+    pthread_mutex_destroy(&writer->transaction_lock);
+    free(writer);
+    pager->writer = NULL;
+}
+
+// Keeps the writer out of the pages until pager_commit.
+void pager_begin_transaction(pager_t* pager) {
+    if (pager->writer != NULL && !pager->in_transaction) {
+        pthread_mutex_lock(&pager->writer->transaction_lock);
+        pager->in_transaction = true;
+    }
+}
+
+void pager_end_transaction(pager_t* pager) {
+    if (pager->in_transaction) {
+        pager->in_transaction = false;
+        pthread_mutex_unlock(&pager->writer->transaction_lock);
+    }
+}
+
+void pager_mark_dirty(pager_t* pager, uint32_t page_num) {
+    if (pager->dirty[page_num]) {
+        return;
+    }
+    pager->dirty[page_num] = true;
+    pager->num_dirty += 1;
+
+    pager_writer_t* writer = pager->writer;
+    if (writer != NULL && pager->num_pages * PAGE_WRITER_DIRTY_PERCENT <= pager->num_dirty * 100) {
+        pthread_mutex_lock(&pager->lock);
+        if (!writer->urgent) {
+            writer->urgent = true;
+            pthread_cond_signal(&writer->wake);
+        }
+        pthread_mutex_unlock(&pager->lock);
+    }
+}
+
+/*
+ * Page versions
+ *
+ * Every write transaction gets the next commit sequence number, and each page
+ * remembers the transaction that produced its current image. A read view pins
+ * a commit and the pages that existed then. When a page some view can see is
+ * first written in a transaction, its current image is pushed onto the page's
+ * history, so the view keeps reading it. Nothing is copied while no view is
+ * open, and images are freed when the last view that reads them closes.
+ *
+ * Views are opened by the foreground between statements. They can be read and
+ * closed from any thread.
+ */
+
+// True if a view at `commit_seq` reads the image that was current from `image_seq` until `newer_seq`.
+bool pager_image_visible(uint64_t image_seq, uint64_t newer_seq, uint64_t commit_seq) {
+    return image_seq <= commit_seq && commit_seq < newer_seq;
+}
+
+// Frees history no open view reads. Caller holds the pager lock.
+void pager_collect_versions(pager_t* pager) {
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES && 0 < pager->num_versions; i++) {
+        uint64_t newer_seq = pager->page_commit_seqs[i];
+        page_version_t** link = &pager->page_history[i];
+
+        while (*link != NULL) {
+            page_version_t* version = *link;
+            bool needed = false;
+            for (read_view_t* view = pager->read_views; view != NULL && !needed; view = view->next) {
+                needed = i < view->num_pages && pager_image_visible(version->commit_seq, newer_seq, view->commit_seq);
+            }
+
+            newer_seq = version->commit_seq;
+            if (needed) {
+                link = &version->older;
+            } else {
+                *link = version->older;
+                free(version->data);
+                free(version);
+                pager->num_versions -= 1;
+            }
+        }
+    }
+}
+
+// Copies the page's current image into its history if an open view reads it. Caller holds the lock if shared.
+void pager_preserve_version(pager_t* pager, uint32_t page_num, void* page) {
+    uint64_t image_seq = pager->page_commit_seqs[page_num];
+    bool needed = false;
+    for (read_view_t* view = pager->read_views; view != NULL && !needed; view = view->next) {
+        needed = page_num < view->num_pages && image_seq <= view->commit_seq;
+    }
+    if (!needed) {
+        return;
+    }
+
+    page_version_t* version = malloc(sizeof(page_version_t));
+    version->commit_seq = image_seq;
+    version->data = malloc(PAGE_SIZE);
+    memcpy(version->data, page, PAGE_SIZE);
+    version->older = pager->page_history[page_num];
+    pager->page_history[page_num] = version;
+    pager->num_versions += 1;
+}
+
+// Ends the current write transaction. Its changes become visible to read views opened afterwards.
+void pager_commit(pager_t* pager) {
+    pager->commit_seq += 1;
+    pager_end_transaction(pager);
+}
+
+// Pins the last commit. Must be called by the foreground outside a transaction.
+read_view_t* pager_open_read_view(pager_t* pager) {
+    read_view_t* view = malloc(sizeof(read_view_t));
+    pthread_mutex_lock(&pager->lock);
+    view->commit_seq = pager->commit_seq;
+    view->num_pages = pager->num_pages;
+    view->next = pager->read_views;
+    pager->read_views = view;
+    pthread_mutex_unlock(&pager->lock);
+    return view;
+}
+
+void pager_close_read_view(pager_t* pager, read_view_t* view) {
+    pthread_mutex_lock(&pager->lock);
+    for (read_view_t** link = &pager->read_views; *link != NULL; link = &(*link)->next) {
+        if (*link == view) {
+            *link = view->next;
+            break;
+        }
+    }
+    pager_collect_versions(pager);
+    pthread_mutex_unlock(&pager->lock);
+    free(view);
+}
+
+/*
+ * Copies the page as `view` sees it into `dest`. Safe to call from another
+ * thread. `dest` must be PAGE_SIZE aligned for PAGER_DIRECT. Returns 0 or an
+ * errno.
+ */
+int pager_read_page(pager_t* pager, read_view_t* view, uint32_t page_num, void* dest) {
+    int error = 0;
+    pthread_mutex_lock(&pager->lock);
+
+    if (view->commit_seq < pager->page_commit_seqs[page_num]) {
+        page_version_t* version = pager->page_history[page_num];
+        while (view->commit_seq < version->commit_seq) {
+            version = version->older;
+        }
+        memcpy(dest, version->data, PAGE_SIZE);
+    } else if (pager->pages[page_num] != NULL) {
+        memcpy(dest, pager->pages[page_num], PAGE_SIZE);
+    } else {
+        // Never loaded, so never written since open.
+        ssize_t bytes_read = pread(pager->file_descriptor, dest, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+        if (bytes_read == -1) {
+            error = errno;
+        } else if (bytes_read < PAGE_SIZE) {
+            memset(dest + bytes_read, 0, PAGE_SIZE - bytes_read);
+        }
+    }
+
+    pthread_mutex_unlock(&pager->lock);
+    return error;
+}
+
+// Returns the page like get_page, but must be used before the page is modified.
+void* get_page_for_write(pager_t* pager, uint32_t page_num) {
+    pager_begin_transaction(pager);
+    void* page = get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+
+    uint64_t transaction_seq = pager->commit_seq + 1;
+    if (pager->page_commit_seqs[page_num] != transaction_seq) {
+        // First write in this transaction.
+        bool shared = pager_lock_if_shared(pager);
+        pager_preserve_version(pager, page_num, page);
+        pager->page_commit_seqs[page_num] = transaction_seq;
+        if (shared) {
+            pthread_mutex_unlock(&pager->lock);
+        }
+    }
+    return page;
+}
+
+pager_t* pager_open(const char* filename, pager_mode_t mode) {
+    int flags = O_RDWR | O_CREAT;
+#ifdef O_DIRECT
+    if (mode == PAGER_DIRECT) {
+        flags |= O_DIRECT;
+    }
+#endif
+    int fd = open(filename, flags, S_IWUSR | S_IRUSR);
+#ifdef O_DIRECT
+    if (fd == -1 && mode == PAGER_DIRECT && errno == EINVAL) {
+        // The file system refuses O_DIRECT. Keep the arena but go through the page cache.
+        printf("Direct I/O is not supported for %s; using buffered I/O\n", filename);
+        fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    }
+#elif defined(F_NOCACHE)
+    if (fd != -1 && mode == PAGER_DIRECT) {
+        fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
     if (fd == -1) {
         printf("Unable to open file\n");
         exit(EXIT_FAILURE);
     }
 
     off_t file_length = lseek(fd, 0, SEEK_END);
+    if (file_length % PAGE_SIZE == 0) {
+        file_length = pager_trim_padding(fd, file_length);
+    }
 
     pager_t* pager = malloc(sizeof(pager_t));
     pager->file_descriptor = fd;
     pager->file_length = file_length;
     pager->num_pages = (uint32_t) (file_length / PAGE_SIZE);
+    pager->mode = mode;
+    pager->arena = NULL;
+    pager->arena_size = 0;
+    pager->arena_advice = MADV_NORMAL;
+    pager->warmup = NULL;
+    pager->num_pages_warmed = 0;
+    pager->num_page_reads = 0;
+    pthread_mutex_init(&pager->lock, NULL);
 
     if (file_length % PAGE_SIZE != 0) {
         printf("Db file is not a whole number of pages. Corrupt file.\n");
         exit(EXIT_FAILURE);
     }
 
+    pager->commit_seq = 0;
+    pager->num_versions = 0;
+    pager->read_views = NULL;
+    pager->num_reader_threads = 0;
     for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
         pager->pages[i] = NULL;
+        pager->page_commit_seqs[i] = 0;
+        pager->page_history[i] = NULL;
+        pager->dirty[i] = false;
+    }
+    pager->num_dirty = 0;
+    pager->writer = NULL;
+    pager->in_transaction = false;
+
+    if (mode == PAGER_DIRECT) {
+        size_t size = (size_t)TABLE_MAX_PAGES * PAGE_SIZE;
+        pager->arena_size = (size + PAGER_ARENA_ALIGNMENT - 1) & ~(PAGER_ARENA_ALIGNMENT - 1);
+        pager->arena = pager_map_arena(pager->arena_size);
+    } else if (mode == PAGER_MMAP) {
+        pager->arena_size = (size_t)TABLE_MAX_PAGES * PAGE_SIZE;
+        pager->arena = mmap(NULL, pager->arena_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (pager->arena == MAP_FAILED) {
+            printf("Error mapping file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager_advise(pager, MADV_RANDOM);
     }
     return pager;
 }
@@ -78,6 +812,12 @@ void pager_flush(pager_t* pager, uint32_t page_num) {
         exit(EXIT_FAILURE);
     }
 
+    if (pager->mode == PAGER_MMAP) {
+        pager_msync(pager, page_num, 1);
+        pager_mark_clean(pager, page_num);
+        return;
+    }
+
     off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
     if (offset == -1) {
         printf("Error seeking: %d\n", errno);
@@ -89,5 +829,6 @@ void pager_flush(pager_t* pager, uint32_t page_num) {
         printf("Error writing: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    pager_mark_clean(pager, page_num);
 }
 
@@ -4,36 +4,47 @@
 
 #pragma once
 #include <stdint.h>
+#include "key.h"
 #include "node.h"
 
 const uint32_t COLUMN_USERNAME_SIZE = 32;
 const uint32_t COLUMN_EMAIL_SIZE = 255;
 
 typedef struct {
-    uint32_t id;
+    uint64_t tenant_id;
+    uint64_t id;
     char username[COLUMN_USERNAME_SIZE + 1];
     char email[COLUMN_EMAIL_SIZE + 1];
 } row_t;
 
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
 
+const uint32_t TENANT_ID_SIZE = size_of_attribute(row_t, tenant_id);
 const uint32_t ID_SIZE = size_of_attribute(row_t, id);
 const uint32_t USERNAME_SIZE = size_of_attribute(row_t, username);
 const uint32_t EMAIL_SIZE = size_of_attribute(row_t, email);
 
-const uint32_t ID_OFFSET = 0;
+const uint32_t TENANT_ID_OFFSET = 0;
+const uint32_t ID_OFFSET = TENANT_ID_OFFSET + TENANT_ID_SIZE;
 const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
 const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t ROW_SIZE = TENANT_ID_SIZE + ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
 void serialize_row(row_t* src, void* dest) {
+    memcpy(dest + TENANT_ID_OFFSET, &(src->tenant_id), TENANT_ID_SIZE);
     memcpy(dest + ID_OFFSET, &(src->id), ID_SIZE);
     memcpy(dest + USERNAME_OFFSET, &(src->username), USERNAME_SIZE);
     memcpy(dest + EMAIL_OFFSET, &(src->email), EMAIL_SIZE);
 }
 
 void deserialize_row(void* src, row_t* dest) {
+    memcpy(&(dest->tenant_id), src + TENANT_ID_OFFSET, TENANT_ID_SIZE);
     memcpy(&(dest->id), src + ID_OFFSET, ID_SIZE);
     memcpy(&(dest->username), src + USERNAME_OFFSET, USERNAME_SIZE);
     memcpy(&(dest->email), src + EMAIL_OFFSET, EMAIL_SIZE);
-}
\ No newline at end of file
+}
+
+void row_key(row_t* row, void* dest) {
+    row_key_t key = {row->tenant_id, row->id};
+    encode_key(&key, dest);
+}
@@ -4,11 +4,39 @@
 
 #pragma once
 
+#include "backup.h"
+#include "hash_index.h"
+#include "memtable.h"
 #include "node.h"
 #include "btree.h"
 #include "values.h"
 
-cursor_t* table_find(table_t* table, uint32_t key) {
+// The leaf under the cursor, as the cursor's read view sees it.
+void* cursor_page(cursor_t* cursor) {
+    if (cursor->view != NULL) {
+        return cursor->page;
+    }
+    return get_page(cursor->table->pager, cursor->page_num);
+}
+
+// True if the cursor points at a cell holding `key`, rather than at the place `key` would be inserted.
+bool cursor_at_key(cursor_t* cur, const void* key) {
+    void* node = cursor_page(cur);
+    return cur->cell_num < *leaf_node_num_cells(node) && compare_keys(leaf_node_key(node, cur->cell_num), key) == 0;
+}
+
+// False if inserting at the cursor would split its leaf and the file has no pages left for that.
+bool cursor_has_room(cursor_t* cur) {
+    void* node = get_page(cur->table->pager, cur->page_num);
+    if (*leaf_node_num_cells(node) < LEAF_NODE_MAX_CELLS) {
+        return true;
+    }
+    // A split takes a new leaf, and a new left child as well when the leaf is the root.
+    uint32_t new_pages = is_node_root(node) ? 2 : 1;
+    return cur->table->pager->num_pages + new_pages <= TABLE_MAX_PAGES;
+}
+
+cursor_t* table_descend(table_t* table, const void* key) {
     uint32_t root_page_num = table->root_page_num;
     void* root_node = get_page(table->pager, root_page_num);
 
@@ -19,26 +47,183 @@ cursor_t* table_find(table_t* table, uint32_t key) {
     }
 }
 
-cursor_t* table_start(table_t* table) {
-    cursor_t* cur = table_find(table, 0);
+cursor_t* table_find(table_t* table, const void* key) {
+    if (table->hash_index != NULL) {
+        cursor_t* cur = hash_index_find(table->hash_index, table, key);
+        if (cur != NULL) {
+            return cur;
+        }
+    }
+
+    pager_advise(table->pager, MADV_RANDOM);
+    cursor_t* cur = table_descend(table, key);
+
+    if (table->hash_index != NULL && cursor_at_key(cur, key)) {
+        hash_index_record(table->hash_index, table->pager, key, cur);
+    }
+    return cur;
+}
 
-    void* node = get_page(table->pager, cur->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
+void table_read_page(table_t* table, read_view_t* view, uint32_t page_num, void* dest) {
+    int error = pager_read_page(table->pager, view, page_num, dest);
+    if (error != 0) {
+        printf("Error reading file: %d\n", error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Like table_descend, but through `view`. The cursor owns a private copy of its leaf.
+cursor_t* table_descend_in_view(table_t* table, read_view_t* view, const void* key) {
+    void* page = NULL;
+    if (posix_memalign(&page, PAGE_SIZE, PAGE_SIZE) != 0) {
+        printf("Unable to allocate page for read view\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t page_num = table->root_page_num;
+    table_read_page(table, view, page_num, page);
+    while (get_node_type(page) == NODE_INTERNAL) {
+        page_num = *internal_node_child(page, internal_node_find_child(page, key));
+        table_read_page(table, view, page_num, page);
+    }
+
+    cursor_t* cur = malloc(sizeof(cursor_t));
+    cur->table = table;
+    cur->page_num = page_num;
+    cur->cell_num = leaf_node_find_cell(page, key);
+    cur->end_of_table = false;
+    cur->view = view;
+    cur->page = page;
+    return cur;
+}
+
+void cursor_free(cursor_t* cur) {
+    if (cur->view != NULL) {
+        free(cur->page);
+    }
+    free(cur);
+}
+
+// Positions a cursor at the first row, read through `view` unless it is NULL.
+cursor_t* table_start(table_t* table, read_view_t* view) {
+    uint8_t min_key[KEY_SIZE];
+    memset(min_key, 0, KEY_SIZE);
+
+    cursor_t* cur;
+    if (view != NULL) {
+        cur = table_descend_in_view(table, view, min_key);
+    } else {
+        pager_advise(table->pager, MADV_SEQUENTIAL);
+        cur = table_descend(table, min_key);
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(cursor_page(cur));
     cur->end_of_table = (num_cells == 0);
     return cur;
 }
 
-table_t* db_open(const char* filename) {
-    pager_t* pager = pager_open(filename);
+// Starts buffering inserts. Scans the leaves once so the memtable's key filter covers the B-tree.
+void table_attach_memtable(table_t* table, uint32_t max_rows) {
+    memtable_t* memtable = memtable_new(max_rows);
+
+    uint8_t min_key[KEY_SIZE];
+    memset(min_key, 0, KEY_SIZE);
+    cursor_t* cur = table_descend(table, min_key);
+    uint32_t page_num = cur->page_num;
+    free(cur);
+
+    while (true) {
+        void* node = get_page(table->pager, page_num);
+        for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+            memtable_filter_add(memtable, leaf_node_key(node, i));
+        }
+        page_num = *leaf_node_next_leaf(node);
+        if (page_num == 0) {
+            break;
+        }
+    }
+    table->memtable = memtable;
+}
+
+/*
+ * Moves every buffered row into the B-tree in key order. Consecutive keys that
+ * belong to the leaf the previous key went into skip the descent from the root,
+ * so each leaf is found once per run of keys rather than once per row.
+ *
+ * Rows were acknowledged when they were buffered, so table_can_buffer_row only
+ * admits as many as the file is sure to have room for. Should the tree still
+ * run out of pages, the drain stops and the rows it could not place stay
+ * buffered.
+ */
+void table_drain_memtable(table_t* table) {
+    memtable_t* memtable = table->memtable;
+    if (memtable == NULL || memtable->num_rows == 0) {
+        return;
+    }
+
+    cursor_t* cur = NULL;
+    memtable_node_t* node = memtable_first(memtable);
+    for (; node != NULL; node = node->forward[0]) {
+        uint8_t key[KEY_SIZE];
+        row_key(&node->row, key);
+
+        bool same_leaf = false;
+        if (cur != NULL) {
+            // A root split turns the previous leaf's page into an internal node.
+            void* leaf = get_page(table->pager, cur->page_num);
+            uint32_t num_cells = *leaf_node_num_cells(leaf);
+            same_leaf = get_node_type(leaf) == NODE_LEAF && num_cells < LEAF_NODE_MAX_CELLS &&
+                        (*leaf_node_next_leaf(leaf) == 0 || compare_keys(key, leaf_node_key(leaf, num_cells - 1)) < 0);
+        }
+
+        if (same_leaf) {
+            uint32_t page_num = cur->page_num;
+            free(cur);
+            cur = leaf_node_find(table, page_num, key);
+        } else {
+            free(cur);
+            cur = table_find(table, key);
+        }
+        if (!cursor_has_room(cur)) {
+            break;
+        }
+        leaf_node_insert(cur, key, &node->row);
+    }
+    free(cur);
+    // Rows that could not be placed stay buffered.
+    while (memtable_first(memtable) != node) {
+        memtable_remove_first(memtable);
+    }
+    pager_commit(table->pager);
+}
+
+// True if the file has room for the buffered rows and one more even if every one of them splits a leaf.
+bool table_can_buffer_row(table_t* table) {
+    // The first root split takes a page on top of the new leaf.
+    return table->pager->num_pages + table->memtable->num_rows + 2 <= TABLE_MAX_PAGES;
+}
+
+table_t* db_open(const char* filename, pager_mode_t mode) {
+    pager_t* pager = pager_open(filename, mode);
 
     table_t* table = malloc(sizeof(table_t));
     table->pager = pager;
+    table->root_page_num = 0;
+    table->backup = NULL;
+    table->hash_index = NULL;
+    table->memtable = NULL;
+    table->read_view = NULL;
+    table->warmup_path = malloc(strlen(filename) + strlen(".warmup") + 1);
+    sprintf(table->warmup_path, "%s.warmup", filename);
 
     if (pager->num_pages == 0) {
         // New database file. Initialze page 0 as leaf node.
-        void* root_node = get_page(pager, 0);
+        void* root_node = get_page_for_write(pager, 0);
         initialize_leaf_node(root_node);
         set_node_root(root_node, true);
+        pager_commit(pager);
+    } else {
+        pager_warmup_start(pager, table->warmup_path);
     }
     return table;
 }
@@ -46,13 +231,39 @@ table_t* db_open(const char* filename) {
 void db_close(table_t* table) {
     pager_t* pager = table->pager;
 
+    if (table->memtable != NULL) {
+        table_drain_memtable(table);
+        memtable_free(table->memtable);
+    }
+    if (table->read_view != NULL) {
+        pager_close_read_view(pager, table->read_view);
+    }
+    backup_finish(table);
+    pager_writer_stop(pager);
+    if (table->hash_index != NULL) {
+        hash_index_free(table->hash_index);
+    }
+    pager_warmup_finish(pager);
+    pager_warmup_dump(pager, table->warmup_path);
+    free(table->warmup_path);
+
+    if (pager->mode == PAGER_MMAP) {
+        // One msync covers every page; the kernel only writes the dirty ones.
+        pager_msync(pager, 0, pager->num_pages);
+    }
     for (uint32_t i = 0; i < pager->num_pages; i++) {
         if (pager->pages[i] == NULL) {
             continue;
         }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+        // Pages the writer already wrote back are clean.
+        if (pager->mode != PAGER_MMAP && pager->dirty[i]) {
+            pager_flush(pager, i);
+        }
+        pager_free_page(pager, i);
+    }
+    if (pager->mode == PAGER_MMAP && ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+        printf("Error truncating db file: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
 
     int result = close(pager->file_descriptor);
@@ -61,11 +272,18 @@ void db_close(table_t* table) {
         exit(EXIT_FAILURE);
     }
     for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
+        if (pager->pages[i]) {
+            pager_free_page(pager, i);
         }
+        while (pager->page_history[i] != NULL) {
+            page_version_t* version = pager->page_history[i];
+            pager->page_history[i] = version->older;
+            free(version->data);
+            free(version);
+        }
+    }
+    if (pager->arena) {
+        munmap(pager->arena, pager->arena_size);
     }
     free(pager);
 }
\ No newline at end of file
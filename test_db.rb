@@ -1,10 +1,14 @@
 require 'test/unit'
 
-def run_script(commands, dbfile=nil)
+def remove_db(filename)
+  system("rm -f " + filename + " " + filename + ".warmup")
+end
+
+def run_script(commands, dbfile=nil, options="")
   filename = dbfile || "mydb.db"
 
   raw_output = nil
-  IO.popen("./cmake-build-debug/lightdb " + filename, "r+") do |pipe|
+  IO.popen("./cmake-build-debug/lightdb " + options + " " + filename, "r+") do |pipe|
     commands.each do |command|
         begin
           pipe.puts command
@@ -19,13 +23,29 @@ def run_script(commands, dbfile=nil)
     raw_output = pipe.gets(nil)
   end
 
-  system("rm " + filename) if dbfile == nil
+  remove_db(filename) if dbfile == nil
 
   raw_output.split("\n")
 end
 
 class TestDB < Test::Unit::TestCase
 
+  # Reopens `dbfile` and checks that it holds exactly rows 1..count.
+  def assert_selects_rows(dbfile, count, options="")
+    result = run_script([
+      "select",
+      ".exit",
+    ], dbfile, options)
+    rows = (1..count).map do |i|
+      "(#{i}, user#{i}, person#{i}@example.com)"
+    end
+    rows[0] = "db > " + rows[0]
+    assert_equal result, rows + [
+      "Executed.",
+      "db > ",
+    ]
+  end
+
   def test_inserts_and_retreives_a_row
     result = run_script([
       "insert 1 user1 person1@example.com",
@@ -47,8 +67,8 @@ class TestDB < Test::Unit::TestCase
     script << ".exit"
     result = run_script(script)
     assert_equal result.last(2), [
-      "db > Executed.",
-      "db > Need to implement splitting internal node",
+      "db > Error: Table full.",
+      "db > ",
     ]
   end
 
@@ -99,6 +119,98 @@ class TestDB < Test::Unit::TestCase
     ]
   end
 
+  def test_allows_64_bit_ids
+    script = [
+      "insert 18446744073709551615 user1 person1@example.com",
+      "insert 4294967296 user2 person2@example.com",
+      "select",
+      ".exit",
+    ]
+    result = run_script(script)
+    assert_equal result, [
+      "db > Executed.",
+      "db > Executed.",
+      "db > (4294967296, user2, person2@example.com)",
+      "(18446744073709551615, user1, person1@example.com)",
+      "Executed.",
+      "db > ",
+    ]
+  end
+
+  def test_prints_an_error_message_if_id_is_malformed
+    script = [
+      "insert 1x user1 person1@example.com",
+      "insert 1: user1 person1@example.com",
+      "insert 18446744073709551616 user1 person1@example.com",
+      "select",
+      ".exit",
+    ]
+    result = run_script(script)
+    assert_equal result, [
+      "db > Syntax error. Could not parse statement.",
+      "db > Syntax error. Could not parse statement.",
+      "db > Syntax error. Could not parse statement.",
+      "db > Executed.",
+      "db > ",
+    ]
+  end
+
+  def test_orders_rows_by_tenant_then_id
+    script = [
+      "insert 2:1 user1 person1@example.com",
+      "insert 1:5 user2 person2@example.com",
+      "insert 3 user3 person3@example.com",
+      "insert 1:5 user4 person4@example.com",
+      "select",
+      ".exit",
+    ]
+    result = run_script(script)
+    assert_equal result, [
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Error: Duplicate key.",
+      "db > (3, user3, person3@example.com)",
+      "(1:5, user2, person2@example.com)",
+      "(2:1, user1, person1@example.com)",
+      "Executed.",
+      "db > ",
+    ]
+  end
+
+  def test_truncates_separators_between_tenants
+    script = (1..7).map do |i|
+      "insert 1:#{i} user#{i} person#{i}@example.com"
+    end
+    script += (1..6).map do |i|
+      "insert 2:#{i} user#{i} person#{i}@example.com"
+    end
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+    assert_equal result[13..(result.length)], [
+      "db > Tree:",
+      "- internal (size 1)",
+      "  - leaf (size 7)",
+      "    - 1:1",
+      "    - 1:2",
+      "    - 1:3",
+      "    - 1:4",
+      "    - 1:5",
+      "    - 1:6",
+      "    - 1:7",
+      "- key 0x0000000000000001..",
+      "  - leaf (size 6)",
+      "    - 2:1",
+      "    - 2:2",
+      "    - 2:3",
+      "    - 2:4",
+      "    - 2:5",
+      "    - 2:6",
+      "db > ",
+    ]
+  end
+
   def test_keeps_data_after_closing_connection
     dbfile = "keeps_data.db"
 
@@ -120,7 +232,298 @@ class TestDB < Test::Unit::TestCase
       "db > ",
     ]
 
-    system("rm " + dbfile)
+    remove_db(dbfile)
+  end
+
+  def test_keeps_data_after_closing_connection_with_direct_io
+    dbfile = "keeps_data_direct.db"
+
+    script = (1..14).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, dbfile, "--direct-io")
+    assert_selects_rows(dbfile, 14, "--direct-io")
+
+    remove_db(dbfile)
+  end
+
+  def test_keeps_data_after_closing_connection_with_mmap
+    dbfile = "keeps_data_mmap.db"
+
+    script = [9, 3, 12, 1, 7, 14, 5, 2, 11, 8, 4, 13, 6, 10].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, dbfile, "--mmap")
+    assert_equal File.size(dbfile), 3 * 4096
+    assert_selects_rows(dbfile, 14)
+
+    remove_db(dbfile)
+  end
+
+  def test_mmap_padding_is_trimmed_after_an_unclean_exit
+    dbfile = "mmap_padding.db"
+
+    # End of input exits without .exit, so db_close never trims the grown file.
+    run_script([
+      "insert 2 user2 person2@example.com",
+      "insert 1 user1 person1@example.com",
+    ], dbfile, "--mmap")
+    assert_equal File.size(dbfile), 16 * 4096
+
+    run_script([
+      "insert 3 user3 person3@example.com",
+    ], dbfile, "--mmap")
+    # The padding was cut off on open, and page 0 still fits in the file.
+    assert_equal File.size(dbfile), 4096
+    assert_selects_rows(dbfile, 3)
+
+    remove_db(dbfile)
+  end
+
+  def test_backs_up_a_snapshot_while_inserting
+    backupfile = "backup.db"
+
+    script = (1..14).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".backup #{backupfile}"
+    script += (15..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    result = run_script(script)
+    assert_equal result[14], "db > Backup started."
+    assert_equal result.last, "db > "
+    assert_selects_rows(backupfile, 14)
+
+    remove_db(backupfile)
+  end
+
+  def test_selects_a_row_by_key
+    script = (1..14).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select 9"
+    script << "select 15"
+    script << "select abc"
+    script << ".exit"
+    result = run_script(script)
+    assert_equal result[14..(result.length)], [
+      "db > (9, user9, person9@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > Syntax error. Could not parse statement.",
+      "db > ",
+    ]
+  end
+
+  def test_adaptive_hash_index_follows_rows_moved_by_a_split
+    script = (1..12).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += ["select 10"] * 4
+    script << "insert 13 user13 person13@example.com"
+    script += ["select 10"] * 2
+    script << ".stats"
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script, nil, "--adaptive-hash-index")
+    selects = result.select { |line| line.include?("user10") }
+    assert_equal selects, ["db > (10, user10, person10@example.com)"] * 6
+    # The fourth lookup and the second after the split skip the descent.
+    assert_includes result, "HASH_INDEX_HITS: 2"
+    assert_equal result.last(8), [
+      "  - leaf (size 6)",
+      "    - 8",
+      "    - 9",
+      "    - 10",
+      "    - 11",
+      "    - 12",
+      "    - 13",
+      "db > ",
+    ]
+  end
+
+  def test_preloads_the_pages_resident_at_close
+    dbfile = "warmup.db"
+
+    script = (1..14).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, dbfile)
+    assert_equal File.binread(dbfile + ".warmup").unpack("L*"), [0x5742444c, 3, 0, 1, 2]
+
+    result = run_script([
+      ".stats",
+      "select",
+      ".stats",
+      ".exit",
+    ], dbfile)
+    assert_equal result[0..3], [
+      "db > Stats:",
+      "PAGES_WARMED: 3",
+      "PAGE_READS: 0",
+      "PAGE_VERSIONS: 0",
+    ]
+    assert_equal result[4], "db > (1, user1, person1@example.com)"
+    assert_equal result[18..(result.length)], [
+      "Executed.",
+      "db > Stats:",
+      "PAGES_WARMED: 3",
+      "PAGE_READS: 0",
+      "PAGE_VERSIONS: 0",
+      "db > ",
+    ]
+
+    remove_db(dbfile)
+  end
+
+  def test_merges_buffered_rows_into_select
+    ids = [9, 3, 12, 1, 7, 14, 5, 2, 11, 8, 4, 13, 6, 10]
+    script = ids.map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "insert 7 user7 person7@example.com"
+    script << "select 4"
+    script << "select"
+    script << ".exit"
+    result = run_script(script, nil, "--memtable=4")
+
+    rows = (1..14).map do |i|
+      "(#{i}, user#{i}, person#{i}@example.com)"
+    end
+    rows[0] = "db > " + rows[0]
+    assert_equal result[14..(result.length)], [
+      "db > Error: Duplicate key.",
+      "db > (4, user4, person4@example.com)",
+      "Executed.",
+    ] + rows + [
+      "Executed.",
+      "db > ",
+    ]
+  end
+
+  def test_drains_buffered_rows_on_close
+    dbfile = "memtable.db"
+
+    run_script([
+      "insert 2 user2 person2@example.com",
+      "insert 1 user1 person1@example.com",
+      ".exit",
+    ], dbfile, "--memtable")
+
+    result = run_script([
+      "select",
+      ".exit",
+    ], dbfile)
+    assert_equal result, [
+      "db > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "Executed.",
+      "db > ",
+    ]
+
+    remove_db(dbfile)
+  end
+
+  def test_buffered_inserts_report_a_full_table
+    dbfile = "memtable_full.db"
+
+    script = (1..1401).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    result = run_script(script, dbfile, "--memtable")
+    executed = result.count("db > Executed.")
+    assert_equal result.last(2), [
+      "db > Error: Table full.",
+      "db > ",
+    ]
+    # Every acknowledged row made it into the file.
+    assert_selects_rows(dbfile, executed)
+
+    remove_db(dbfile)
+  end
+
+  def test_buffered_inserts_reject_keys_already_in_the_tree
+    dbfile = "memtable_filter.db"
+
+    run_script([
+      "insert 1 user1 person1@example.com",
+      "insert 3 user3 person3@example.com",
+      ".exit",
+    ], dbfile)
+
+    result = run_script([
+      "insert 3 user3 person3@example.com",
+      "insert 2 user2 person2@example.com",
+      "insert 2 user2 person2@example.com",
+      ".exit",
+    ], dbfile, "--memtable")
+    assert_equal result, [
+      "db > Error: Duplicate key.",
+      "db > Executed.",
+      "db > Error: Duplicate key.",
+      "db > ",
+    ]
+    assert_selects_rows(dbfile, 3)
+
+    remove_db(dbfile)
+  end
+
+  def test_reads_through_a_snapshot_across_splits
+    script = (1..7).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".snapshot"
+    # The eighth row splits the root leaf, rewriting every page the snapshot saw.
+    script += [14, 8, 11, 9, 13, 10, 12].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select"
+    script << "select 10"
+    script << "select 3"
+    script << ".release"
+    script << "select"
+    script << ".exit"
+    result = run_script(script)
+
+    rows = (1..14).map do |i|
+      "(#{i}, user#{i}, person#{i}@example.com)"
+    end
+    assert_equal result[7], "db > Snapshot opened."
+    assert_equal result[15..(result.length)], ["db > " + rows[0]] + rows[1..6] + [
+      "Executed.",
+      "db > Executed.",
+      "db > " + rows[2],
+      "Executed.",
+      "db > Snapshot released.",
+      "db > " + rows[0],
+    ] + rows[1..13] + [
+      "Executed.",
+      "db > ",
+    ]
+  end
+
+  def test_page_writer_persists_rows_before_close
+    dbfile = "page_writer.db"
+
+    IO.popen("./cmake-build-debug/lightdb --page-writer " + dbfile, "r+") do |pipe|
+      [9, 3, 12, 1, 7, 14, 5, 2, 11, 8, 4, 13, 6, 10].each do |i|
+        pipe.puts "insert #{i} user#{i} person#{i}@example.com"
+      end
+      sleep 0.5
+      # Exit on end of input without .exit, so db_close never flushes.
+      pipe.close_write
+      pipe.gets(nil)
+    end
+    assert_equal File.size(dbfile), 3 * 4096
+    assert_selects_rows(dbfile, 14)
+
+    remove_db(dbfile)
   end
 
   def test_prints_constants
@@ -130,12 +533,12 @@ class TestDB < Test::Unit::TestCase
     ])
     assert_equal result, [
       "db > Constants:",
-      "ROW_SIZE: 293",
+      "ROW_SIZE: 305",
       "COMMON_NODE_HEADER_SIZE: 6",
       "LEAF_NODE_HEADER_SIZE: 14",
-      "LEAF_NODE_CELL_SIZE: 297",
+      "LEAF_NODE_CELL_SIZE: 321",
       "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-      "LEAF_NODE_MAX_CELLS: 13",
+      "LEAF_NODE_MAX_CELLS: 12",
       "db > ",
     ]
   end
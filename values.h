@@ -4,18 +4,121 @@
 
 #pragma once
 
+#include <pthread.h>
+
+#include <stdint.h>
+
 const uint32_t TABLE_MAX_PAGES = 100;
 
+typedef enum {
+    PAGER_BUFFERED,  // Pages are malloc'd and I/O goes through the kernel page cache
+    PAGER_DIRECT,    // Pages live in one aligned arena and I/O bypasses the kernel page cache
+    PAGER_MMAP       // Pages are pointers into a shared mapping of the file
+} pager_mode_t;
+
+// Pages listed in the warm-up file, being preloaded on a background thread.
+typedef struct {
+    pthread_t thread;
+    uint32_t* page_nums;  // Sorted and unique
+    uint32_t num_page_nums;
+    bool done;  // Guarded by the pager lock
+} pager_warmup_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t transaction_lock;  // Held by the foreground from its first page write to pager_commit
+    pthread_cond_t wake;               // Signalled when the dirty ratio crosses the threshold, and on stop
+    uint32_t pages_per_second;
+    uint32_t next_page_num;  // Where the next sweep resumes
+    bool urgent;             // Guarded by the pager lock
+    bool stop;               // Guarded by the pager lock
+} pager_writer_t;
+
+// An older image of a page, kept while a read view may still need it.
+typedef struct page_version {
+    uint64_t commit_seq;  // Commit that produced this image
+    void* data;
+    struct page_version* older;
+} page_version_t;
+
+// A reader's view of the first num_pages pages as of one commit.
+typedef struct read_view {
+    uint64_t commit_seq;
+    uint32_t num_pages;
+    struct read_view* next;
+} read_view_t;
+
 typedef struct {
     int file_descriptor;
     off_t file_length;
     uint32_t num_pages;
+    pager_mode_t mode;
+    void* arena;  // Backing memory for all pages in PAGER_DIRECT and PAGER_MMAP modes
+    size_t arena_size;
+    int arena_advice;  // Last madvise hint given for a PAGER_MMAP arena
+    pager_warmup_t* warmup;  // NULL once warm-up has been joined
+    uint32_t num_pages_warmed;  // Pages warm-up loaded before the foreground asked for them
+    uint32_t num_page_reads;    // Pages get_page had to read from the file itself
+    pthread_mutex_t lock;    // Guards the page table while another thread uses the pager
     void* pages[TABLE_MAX_PAGES];
+    bool dirty[TABLE_MAX_PAGES];              // Changed since it was last written to the file
+    uint32_t num_dirty;
+    pager_writer_t* writer;  // NULL unless the background writer is running
+    bool in_transaction;     // The foreground holds the writer's transaction_lock
+
+    // Multi-version pages for read views
+    uint64_t commit_seq;                            // Last committed write transaction
+    uint64_t page_commit_seqs[TABLE_MAX_PAGES];     // Transaction that produced each page's current image
+    page_version_t* page_history[TABLE_MAX_PAGES];  // Older images some view still reads, newest first
+    uint32_t num_versions;
+    read_view_t* read_views;
+    uint32_t num_reader_threads;  // Threads reading through a view. Only changed by the foreground
 } pager_t;
 
+typedef struct {
+    pthread_t thread;
+    pager_t* pager;
+    int file_descriptor;
+    read_view_t* view;  // Pins the pages being copied. Closed by the backup thread when it is done
+    bool done;  // Guarded by the pager lock
+    int error;  // errno of the first failed write, 0 on success
+} backup_t;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t page_num;
+    uint32_t cell_num;
+    uint64_t page_commit_seq;
+    uint32_t hits;
+} hash_index_entry_t;
+
+typedef struct {
+    hash_index_entry_t* buckets;
+    uint32_t num_hits;  // Lookups served without a descent
+} hash_index_t;
+
+typedef struct memtable_node {
+    row_t row;
+    struct memtable_node* forward[];  // One next pointer per level the node is on
+} memtable_node_t;
+
+typedef struct {
+    memtable_node_t* head;
+    uint8_t* key_filter;  // Bloom filter over every key in the memtable or the B-tree
+    uint32_t level;
+    uint32_t num_rows;
+    uint32_t max_rows;
+    uint64_t random_state;
+} memtable_t;
+
 typedef struct {
     pager_t* pager;
     uint32_t root_page_num;
+    backup_t* backup;  // Running or finished-but-not-joined backup, if any
+    hash_index_t* hash_index;  // NULL unless the adaptive hash index is enabled
+    memtable_t* memtable;      // NULL unless inserts are buffered
+    char* warmup_path;         // Lists the pages to preload on the next open
+    read_view_t* read_view;    // Snapshot that selects read from, NULL if none is open
 } table_t;
 
 typedef struct {
@@ -23,4 +126,6 @@ typedef struct {
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;  // Indicates a position one past the last element
+    read_view_t* view;  // Non-NULL for cursors reading through a view
+    void* page;         // View cursors: private copy of the current leaf
 } cursor_t;
\ No newline at end of file